@@ -12,9 +12,133 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
+        
+/* Compiling with MEASURE_ENERGY defined makes measure() also read the RAPL
+ * package and DRAM energy counters exposed by Linux under
+ * /sys/class/powercap/intel-rapl around each trial, and return the energy
+ * per invocation (in nJ, trimmed mean) next to the usual time; each column
+ * then prints as time;energy. Energy is whole-system (all packages, idle
+ * and other processes included) and prints as n/a if the counters are not
+ * present or not readable (energy_uj is usually root-only).
+ */
+
+#if defined(MEASURE_ENERGY)
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class rapl_counters
+{
+public:
+  rapl_counters()
+  {
+    static const std::string root="/sys/class/powercap/intel-rapl:";
+
+    for(int p=0;;++p){
+      std::string package=root+std::to_string(p);
+      if(!add_zone(package))break;
+      for(int q=0;;++q){
+        if(!add_zone(package+"/intel-rapl:"+std::to_string(p)+":"+
+                     std::to_string(q)))break;
+      }
+    }
+  }
+
+  bool available()const{return !zones.empty();}
+
+  std::vector<std::uint64_t> sample()const
+  {
+    std::vector<std::uint64_t> res;
+    for(const auto& z:zones){
+      std::ifstream is(z.path+"/energy_uj");
+      std::uint64_t e=0;
+      is>>e;
+      res.push_back(e);
+    }
+    return res;
+  }
+
+  double joules(
+    const std::vector<std::uint64_t>& s0,
+    const std::vector<std::uint64_t>& s1)const
+  {
+    double res=0;
+    for(std::size_t i=0;i<zones.size();++i){
+      res+=s1[i]>=s0[i]?
+        s1[i]-s0[i]:
+        zones[i].max_range-s0[i]+s1[i]; /* counter wrapped around */
+    }
+    return res/1E6;
+  }
+
+private:
+  struct zone
+  {
+    std::string   path;
+    std::uint64_t max_range;
+  };
+
+  /* returns false if the zone does not exist */
+  bool add_zone(const std::string& path)
+  {
+    std::ifstream name_file(path+"/name");
+    std::string   name;
+    if(!(name_file>>name))return false;
+    if(name.compare(0,7,"package")!=0&&name!="dram")return true;
+
+    std::ifstream energy_file(path+"/energy_uj"),
+                  range_file(path+"/max_energy_range_uj");
+    std::uint64_t energy,max_range;
+    if(energy_file>>energy&&range_file>>max_range){
+      zones.push_back({path,max_range});
+    }
+    return true;
+  }
+
+  std::vector<zone> zones;
+};
+
+const rapl_counters& rapl()
+{
+  static const rapl_counters res;
+  return res;
+}
+
+struct measure_result
+{
+  double mean,energy;
+};
+
+measure_result operator/(const measure_result& x,double n)
+{
+  return {x.mean/n,x.energy/n};
+}
+
+std::ostream& operator<<(std::ostream& os,const measure_result& x)
+{
+  os<<x.mean<<";";
+  if(std::isnan(x.energy))return os<<"n/a";
+  else                    return os<<x.energy;
+}
+
+const char* not_measured="n/a;n/a";
+const char* const measure_fields[]={" time"," nJ"};
+#else
+typedef double measure_result;
+
+const char* not_measured="n/a";
+const char* const measure_fields[]={""};
+#endif
         
 template<typename F>
-double measure(F f)
+measure_result measure(F f)
 {
   using namespace std::chrono;
         
@@ -22,11 +146,18 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
+#if defined(MEASURE_ENERGY)
+  std::array<double,num_trials> energies;
+#endif
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
     high_resolution_clock::time_point t2;
         
+#if defined(MEASURE_ENERGY)
+    std::vector<std::uint64_t> e0=rapl().sample();
+#endif
     measure_start=high_resolution_clock::now();
     do{
       res=f();
@@ -34,16 +165,31 @@ double measure(F f)
       t2=high_resolution_clock::now();
     }while(t2-measure_start<min_time_per_trial);
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+#if defined(MEASURE_ENERGY)
+    energies[i]=rapl().joules(e0,rapl().sample())/runs;
+#endif
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
-  return std::accumulate(
+  double mean=std::accumulate(
     trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+#if defined(MEASURE_ENERGY)
+  double energy=std::numeric_limits<double>::quiet_NaN();
+  if(rapl().available()){
+    std::sort(energies.begin(),energies.end());
+    energy=std::accumulate(
+      energies.begin()+2,energies.end()-2,0.0)/(energies.size()-4)*1E9;
+  }
+  return {mean,energy};
+#else
+  return mean;
+#endif
 }
  
 template<typename Size,typename F>
-double measure(Size n,F f)
+measure_result measure(Size n,F f)
 {
   return measure(f)/n;
 }
@@ -58,10 +204,166 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
 #include <algorithm>
+#include <cstdint>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
+/* Allocator obtaining memory directly from mmap with a given page policy
+ * (Linux only):
+ *   - small_pages: 4KB pages, transparent huge pages explicitly disabled,
+ *   - transparent_huge_pages: 2MB-aligned region with madvise(MADV_HUGEPAGE),
+ *   - huge_pages_2mb, huge_pages_1gb: hugetlbfs pages, which must have
+ *     been reserved beforehand (e.g. through /proc/sys/vm/nr_hugepages);
+ *     std::bad_alloc is thrown otherwise.
+ */
+
+enum class page_policy
+{
+  small_pages,transparent_huge_pages,huge_pages_2mb,huge_pages_1gb
+};
+
+template<typename T,page_policy Policy>
+class page_allocator
+{
+public:
+  using value_type=T;
+
+  template<typename U>
+  struct rebind{using other=page_allocator<U,Policy>;};
+
+  page_allocator()=default;
+  template<typename U>
+  page_allocator(const page_allocator<U,Policy>&){}
+
+  T* allocate(std::size_t n)
+  {
+    std::size_t size=mapping_size(n);
+    int         flags=MAP_PRIVATE|MAP_ANONYMOUS;
+    if(Policy==page_policy::huge_pages_2mb)
+      flags|=MAP_HUGETLB|(21<<MAP_HUGE_SHIFT);
+    else if(Policy==page_policy::huge_pages_1gb)
+      flags|=MAP_HUGETLB|(30<<MAP_HUGE_SHIFT);
+    else if(Policy==page_policy::transparent_huge_pages)
+      size+=page_size(); /* room for aligning to a huge page boundary */
+
+    void* p=mmap(nullptr,size,PROT_READ|PROT_WRITE,flags,-1,0);
+    if(p==MAP_FAILED)throw std::bad_alloc();
+
+    if(Policy==page_policy::small_pages){
+      madvise(p,size,MADV_NOHUGEPAGE);
+    }
+    else if(Policy==page_policy::transparent_huge_pages){
+      char*       first=static_cast<char*>(p);
+      std::size_t head=(page_size()-
+        reinterpret_cast<std::uintptr_t>(first)%page_size())%page_size();
+      if(head)munmap(first,head);
+      munmap(first+head+mapping_size(n),page_size()-head);
+      p=first+head;
+      madvise(p,mapping_size(n),MADV_HUGEPAGE);
+    }
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p,std::size_t n)
+  {
+    munmap(p,mapping_size(n));
+  }
+
+  template<typename U>
+  friend bool operator==(const page_allocator&,const page_allocator<U,Policy>&)
+    {return true;}
+  template<typename U>
+  friend bool operator!=(const page_allocator&,const page_allocator<U,Policy>&)
+    {return false;}
+
+private:
+  static std::size_t page_size()
+  {
+    switch(Policy){
+      case page_policy::small_pages:            return 4096;
+      case page_policy::transparent_huge_pages:
+      case page_policy::huge_pages_2mb:         return std::size_t(1)<<21;
+      case page_policy::huge_pages_1gb:
+      default:                                  return std::size_t(1)<<30;
+    }
+  }
+
+  static std::size_t mapping_size(std::size_t n)
+  {
+    std::size_t size=n*sizeof(T);
+    return (size+page_size()-1)/page_size()*page_size();
+  }
+};
+
+/* Read-only memory mapping of a whole file (POSIX only). */
+
+class mapped_file
+{
+public:
+  explicit mapped_file(const char* path)
+  {
+    int fd=open(path,O_RDONLY);
+    if(fd==-1)throw std::runtime_error(std::string("can't open ")+path);
+
+    struct stat st;
+    if(fstat(fd,&st)==-1){
+      close(fd);
+      throw std::runtime_error(std::string("can't stat ")+path);
+    }
+    size_=static_cast<std::size_t>(st.st_size);
+    if(size_){
+      data_=mmap(nullptr,size_,PROT_READ,MAP_PRIVATE,fd,0);
+      if(data_==MAP_FAILED){
+        close(fd);
+        throw std::runtime_error(std::string("can't map ")+path);
+      }
+    }
+    close(fd);
+  }
+
+  mapped_file(const mapped_file&)=delete;
+  mapped_file& operator=(const mapped_file&)=delete;
+
+  ~mapped_file()
+  {
+    if(size_)munmap(data_,size_);
+  }
+
+  template<typename T>
+  const T* data()const{return static_cast<const T*>(data_);}
+  std::size_t size()const{return size_;}
+
+private:
+  void*       data_=nullptr;
+  std::size_t size_=0;
+};
+
 struct particle
 {
   int x,y,z;
@@ -70,23 +372,37 @@ struct particle
 
 using particle_aos=std::vector<particle>;
 
-particle_aos create_particle_aos(int n)
+template<typename Allocator>
+std::vector<particle,Allocator> create_particle_aos(
+  int n,const Allocator& al)
 {
-  particle_aos res;
+  std::vector<particle,Allocator> res(al);
   res.reserve(n);
   for(int i=0;i<n;++i)res.push_back({i,i+1,i+2,i+3,i+4,i+5});
   return res;
 }
 
-struct particle_soa
+particle_aos create_particle_aos(int n)
+{
+  return create_particle_aos(n,std::allocator<particle>());
+}
+
+template<typename Allocator>
+struct basic_particle_soa
 {
-  std::vector<int> x,y,z;
-  std::vector<int> dx,dy,dz;
+  explicit basic_particle_soa(const Allocator& al=Allocator()):
+    x(al),y(al),z(al),dx(al),dy(al),dz(al){}
+
+  std::vector<int,Allocator> x,y,z;
+  std::vector<int,Allocator> dx,dy,dz;
 };
 
-particle_soa create_particle_soa(int n)
+using particle_soa=basic_particle_soa<std::allocator<int>>;
+
+template<typename Allocator>
+basic_particle_soa<Allocator> create_particle_soa(int n,const Allocator& al)
 {
-  particle_soa res;
+  basic_particle_soa<Allocator> res(al);
   res.x.reserve(n);
   res.y.reserve(n);
   res.z.reserve(n);
@@ -104,31 +420,210 @@ particle_soa create_particle_soa(int n)
   return res;
 }
 
-int main()
+particle_soa create_particle_soa(int n)
 {
-  std::size_t n0=10000,n1=40000000,dn=2000;
-  double      fdn=1.1;    
+  return create_particle_soa(n,std::allocator<int>());
+}
 
-  std::cout<<"aos vs soa:"<<std::endl;
-  std::cout<<"n;aos;soa"<<std::endl;
-    
+/* SOA view over n particles stored column after column, as in the SOA
+ * layout files written by dataset_generator.
+ */
+
+struct particle_soa_view
+{
+  particle_soa_view(const int* p,std::size_t n):
+    x(p),y(p+n),z(p+2*n),dx(p+3*n),dy(p+4*n),dz(p+5*n){}
+
+  const int *x,*y,*z;
+  const int *dx,*dy,*dz;
+};
+
+template<typename ParticleAOS>
+long int sum_aos(const ParticleAOS& ps,std::size_t n)
+{
+  long int res=0;
+  for(std::size_t i=0;i<n;++i)res+=ps[i].x+ps[i].y+ps[i].z;
+  return res;
+}
+
+template<typename ParticleSOA>
+long int sum_soa(const ParticleSOA& ps,std::size_t n)
+{
+  long int res=0;
+  for(std::size_t i=0;i<n;++i)res+=ps.x[i]+ps.y[i]+ps.z[i];
+  return res;
+}
+
+/* Size sweep measured column by column rather than row by row, so that
+ * each column can build its data once for the largest size, work on
+ * prefixes and release it before the next column starts: only one
+ * column's data is in memory at any time. Rows are printed at the end;
+ * the setup column adds up, for each size, the time spent outside
+ * measure() right before each of its measurements (building a column's
+ * data thus shows up in the first row).
+ */
+
+class size_sweep
+{
+public:
+  size_sweep(std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+  {
+    for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+      sizes.push_back(n);
+    }
+    rows.resize(sizes.size());
+    setup_times.resize(sizes.size());
+  }
+
+  /* f(n) is measured for every size n, after prepare(n) if given */
+
+  template<typename F>
+  void column(F f)
+  {
+    column([](std::size_t){},f);
+  }
+
+  template<typename Prepare,typename F>
+  void column(Prepare prepare,F f)
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::size_t        n=sizes[i];
+      std::ostringstream os;
+      prepare(n);
+      setup_times[i]+=setup_time();
+      os<<measure(n,[&](){return f(n);})<<";";
+      rows[i]+=os.str();
+    }
+  }
+
+  void not_measured_column()
+  {
+    for(auto& row:rows)row+=std::string(not_measured)+";";
+  }
+
+  void print()
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::cout<<sizes[i]<<";"<<rows[i]<<setup_times[i]<<"\n";
+    }
+  }
+
+private:
+  std::vector<std::size_t> sizes;
+  std::vector<std::string> rows;
+  std::vector<double>      setup_times;
+};
+
+/* Header naming every field printed for each of the given columns
+ * (separated by ';'), e.g. "aos time;aos nJ;..." in energy mode.
+ */
+
+std::string measure_header(const std::string& columns)
+{
+  std::string res;
+  for(std::size_t first=0;;){
+    std::size_t last=columns.find(';',first);
+    std::string column=columns.substr(first,last-first);
+    for(const char* field:measure_fields){
+      if(!res.empty())res+=";";
+      res+=column+field;
+    }
+    if(last==std::string::npos)return res;
+    first=last+1;
+  }
+}
+
+/* aos and soa columns with memory allocated under the given page policy
+ * for the largest size, not_measured if the system can't provide such
+ * pages.
+ */
+
+template<page_policy Policy>
+void measure_with_pages(size_sweep& sweep,std::size_t n1)
+{
+  try{
+    auto ps=create_particle_aos(n1,page_allocator<particle,Policy>());
+    sweep.column([&](std::size_t n){return sum_aos(ps,n);});
+  }
+  catch(const std::bad_alloc&){
+    sweep.not_measured_column();
+  }
+  try{
+    auto ps=create_particle_soa(n1,page_allocator<int,Policy>());
+    sweep.column([&](std::size_t n){return sum_soa(ps,n);});
+  }
+  catch(const std::bad_alloc&){
+    sweep.not_measured_column();
+  }
+}
+
+/* aos and soa columns over particle datasets previously written by
+ * dataset_generator in AOS and SOA layout, respectively: data is mapped
+ * into memory rather than synthesized, and each size step works on a
+ * prefix of the files.
+ */
+
+void measure_mapped(
+  const char* aos_path,const char* soa_path,
+  std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+{
+  mapped_file aos_file(aos_path),soa_file(soa_path);
+  std::size_t aos_n=aos_file.size()/sizeof(particle),
+              soa_n=soa_file.size()/(6*sizeof(int));
+  auto        aos=aos_file.data<particle>();
+  auto        soa=particle_soa_view(soa_file.data<int>(),soa_n);
+
+  std::cout<<"aos vs soa (mapped datasets):"<<std::endl;
+  std::cout<<"n;"<<measure_header("aos;soa")<<std::endl;
+
+  n1=std::min(n1,std::min(aos_n,soa_n));
   for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
     std::cout<<n<<";";
-    {
-      auto ps=create_particle_aos(n);
-      std::cout<<measure(n,[&](){
-        long int res=0;
-        for(std::size_t i=0;i<n;++i)res+=ps[i].x+ps[i].y+ps[i].z;
-        return res;
-      })<<";";
+    std::cout<<measure(n,[&](){return sum_aos(aos,n);})<<";";
+    std::cout<<measure(n,[&](){return sum_soa(soa,n);})<<"\n";
+  }
+}
+
+int main(int argc,char* argv[])
+{
+  std::size_t n0=10000,n1=40000000,dn=2000;
+  double      fdn=1.1;    
+
+  if(argc==3){
+    try{
+      measure_mapped(argv[1],argv[2],n0,n1,dn,fdn);
+      return 0;
     }
-    {
-      auto ps=create_particle_soa(n);
-      std::cout<<measure(n,[&](){
-        long int res=0;
-        for(std::size_t i=0;i<n;++i)res+=ps.x[i]+ps.y[i]+ps.z[i];
-        return res;
-      })<<"\n";
+    catch(const std::exception& e){
+      std::cerr<<e.what()<<std::endl;
+      return 1;
     }
   }
+  else if(argc!=1){
+    std::cerr<<"usage: "<<argv[0]<<" [aos_dataset soa_dataset]"<<std::endl;
+    return 1;
+  }
+
+  std::cout<<"aos vs soa:"<<std::endl;
+  std::cout<<"n;"<<measure_header(
+    "aos;soa;aos 4K;soa 4K;aos THP;soa THP;aos 2M;soa 2M;aos 1G;soa 1G")
+           <<";setup"<<std::endl;
+
+  /* every column works on prefixes of data generated once for the
+   * largest size
+   */
+  size_sweep sweep(n0,n1,dn,fdn);
+  {
+    auto aos=create_particle_aos(n1);
+    sweep.column([&](std::size_t n){return sum_aos(aos,n);});
+  }
+  {
+    auto soa=create_particle_soa(n1);
+    sweep.column([&](std::size_t n){return sum_soa(soa,n);});
+  }
+  measure_with_pages<page_policy::small_pages>(sweep,n1);
+  measure_with_pages<page_policy::transparent_huge_pages>(sweep,n1);
+  measure_with_pages<page_policy::huge_pages_2mb>(sweep,n1);
+  measure_with_pages<page_policy::huge_pages_1gb>(sweep,n1);
+  sweep.print();
 }
@@ -0,0 +1,242 @@
+/* usingstdcpp2015: columnar filter-aggregate scans vs row-at-a-time.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+ 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric> 
+    
+std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
+        
+template<typename F>
+double measure(F f)
+{
+  using namespace std::chrono;
+        
+  static const int              num_trials=10;
+  static const milliseconds     min_time_per_trial(200);
+  std::array<double,num_trials> trials;
+  volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
+        
+  for(int i=0;i<num_trials;++i){
+    int                               runs=0;
+    high_resolution_clock::time_point t2;
+        
+    measure_start=high_resolution_clock::now();
+    do{
+      res=f();
+      ++runs;
+      t2=high_resolution_clock::now();
+    }while(t2-measure_start<min_time_per_trial);
+    trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+  }
+  (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
+        
+  std::sort(trials.begin(),trials.end());
+  return std::accumulate(
+    trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+}
+ 
+template<typename Size,typename F>
+double measure(Size n,F f)
+{
+  return measure(f)/n;
+}
+
+void pause_timing()
+{
+  measure_pause=std::chrono::high_resolution_clock::now();
+}
+        
+void resume_timing()
+{
+  measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
+}
+
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct particle
+{
+  int x,y,z;
+  int dx,dy,dz;
+};
+
+using particle_aos=std::vector<particle>;
+
+struct particle_soa
+{
+  std::vector<int> x,y,z;
+  std::vector<int> dx,dy,dz;
+};
+
+/* Mini columnar engine for queries of the form
+ *
+ *   select sum(c1+...+ck) where f<threshold
+ *
+ * executed batch by batch: the filter column is scanned first, producing
+ * either a selection vector (indices of matching rows) or a bitmap, and
+ * only then are the aggregated columns visited, for selected rows only
+ * (late materialization). Batches are small enough for the selection and
+ * the touched slices of all columns to stay in L1/L2.
+ */
+
+struct scan_query
+{
+  const std::vector<int>*              filter_column;
+  int                                  threshold;
+  std::vector<const std::vector<int>*> sum_columns;
+};
+
+static const std::size_t batch_size=1024;
+
+std::size_t select_less(
+  const int* x,std::size_t count,int threshold,std::uint16_t* sel)
+{
+  std::size_t k=0;
+  for(std::size_t i=0;i<count;++i){ /* branchless */
+    sel[k]=static_cast<std::uint16_t>(i);
+    k+=x[i]<threshold;
+  }
+  return k;
+}
+
+void bitmap_less(
+  const int* x,std::size_t count,int threshold,std::uint64_t* bits)
+{
+  for(std::size_t w=0;w<(count+63)/64;++w){
+    std::uint64_t word=0;
+    for(std::size_t i=w*64,last=std::min(count,i+64);i<last;++i){
+      word|=std::uint64_t(x[i]<threshold)<<(i%64);
+    }
+    bits[w]=word;
+  }
+}
+
+long int sum_selected(const int* x,const std::uint16_t* sel,std::size_t k)
+{
+  long int res=0;
+  for(std::size_t i=0;i<k;++i)res+=x[sel[i]];
+  return res;
+}
+
+long int sum_bitmap(const int* x,const std::uint64_t* bits,std::size_t count)
+{
+  long int res=0;
+  for(std::size_t w=0;w<(count+63)/64;++w){
+    for(std::uint64_t word=bits[w];word;word&=word-1){
+      res+=x[w*64+__builtin_ctzll(word)];
+    }
+  }
+  return res;
+}
+
+long int execute_with_selection_vector(const scan_query& q,std::size_t n)
+{
+  std::uint16_t sel[batch_size];
+  long int      res=0;
+  for(std::size_t first=0;first<n;first+=batch_size){
+    std::size_t count=std::min(batch_size,n-first);
+    std::size_t k=select_less(
+      q.filter_column->data()+first,count,q.threshold,sel);
+    for(auto c:q.sum_columns)res+=sum_selected(c->data()+first,sel,k);
+  }
+  return res;
+}
+
+long int execute_with_bitmap(const scan_query& q,std::size_t n)
+{
+  std::uint64_t bits[batch_size/64];
+  long int      res=0;
+  for(std::size_t first=0;first<n;first+=batch_size){
+    std::size_t count=std::min(batch_size,n-first);
+    bitmap_less(q.filter_column->data()+first,count,q.threshold,bits);
+    for(auto c:q.sum_columns)res+=sum_bitmap(c->data()+first,bits,count);
+  }
+  return res;
+}
+
+int main()
+{
+  std::size_t n0=10000,n1=40000000,dn=2000;
+  double      fdn=1.1;    
+  int         max_coord=1000,threshold=100; /* 10% selectivity */
+
+  std::cout<<"columnar scan (sum(y+z) where x<"<<threshold<<"):"<<std::endl;
+  std::cout<<"n;aos rows;soa rows;soa selection vector;soa bitmap;setup"
+           <<std::endl;
+
+  /* data generated once for the largest size, steps work on prefixes */
+  particle_aos                    aos;
+  particle_soa                    soa;
+  std::mt19937                    gen;
+  std::uniform_int_distribution<> rnd(0,max_coord-1);
+  aos.reserve(n1);
+  for(std::size_t i=0;i<n1;++i){
+    aos.push_back({rnd(gen),rnd(gen),rnd(gen),rnd(gen),rnd(gen),rnd(gen)});
+  }
+  for(const auto& p:aos){
+    soa.x.push_back(p.x);
+    soa.y.push_back(p.y);
+    soa.z.push_back(p.z);
+    soa.dx.push_back(p.dx);
+    soa.dy.push_back(p.dy);
+    soa.dz.push_back(p.dz);
+  }
+
+  scan_query q={&soa.x,threshold,{&soa.y,&soa.z}};
+    
+  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+    std::cout<<n<<";";
+    std::cout<<measure(n,[&](){
+      long int res=0;
+      for(std::size_t i=0;i<n;++i){
+        if(aos[i].x<threshold)res+=aos[i].y+aos[i].z;
+      }
+      return res;
+    })<<";";
+    std::cout<<measure(n,[&](){
+      long int res=0;
+      for(std::size_t i=0;i<n;++i){
+        if(soa.x[i]<threshold)res+=soa.y[i]+soa.z[i];
+      }
+      return res;
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return execute_with_selection_vector(q,n);
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return execute_with_bitmap(q,n);
+    })<<";";
+    std::cout<<setup_time()<<"\n";
+  }
+}
@@ -0,0 +1,126 @@
+/* usingstdcpp2015: dataset generator for the mapped input mode.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+/* Writes raw binary datasets that aos_vs_soa, filtered_sum and matrix_sum
+ * can map into memory instead of synthesizing their inputs:
+ *
+ *   dataset_generator particles-aos n file
+ *     n particles {x,y,z,dx,dy,dz} one after another (ints),
+ *   dataset_generator particles-soa n file
+ *     the same particles as six consecutive columns of n ints each
+ *     (particle i has fields i,...,i+5, so n can't exceed INT_MAX-4),
+ *   dataset_generator ints n file
+ *     n random ints in [0,255].
+ *
+ * Files carry no header and are in native byte order, so production data
+ * dumped with the same layout can be fed directly to the benchmarks.
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct particle
+{
+  int x,y,z;
+  int dx,dy,dz;
+};
+
+template<typename T>
+void write_buffer(std::ofstream& out,std::vector<T>& buf)
+{
+  out.write(
+    reinterpret_cast<const char*>(buf.data()),
+    static_cast<std::streamsize>(buf.size()*sizeof(T)));
+  buf.clear();
+}
+
+int main(int argc,char* argv[])
+{
+  if(argc!=4){
+    std::cerr<<"usage: "<<argv[0]<<" particles-aos|particles-soa|ints n file"
+             <<std::endl;
+    return 1;
+  }
+
+  const char* kind=argv[1];
+  if(std::strcmp(kind,"particles-aos")!=0&&
+     std::strcmp(kind,"particles-soa")!=0&&
+     std::strcmp(kind,"ints")!=0){
+    std::cerr<<"unknown dataset kind "<<kind<<std::endl;
+    return 1;
+  }
+
+  char*              end;
+  errno=0;
+  unsigned long long n=std::strtoull(argv[2],&end,10);
+  if(!std::isdigit(static_cast<unsigned char>(argv[2][0]))||*end||
+     errno==ERANGE||n==0){
+    std::cerr<<"invalid number of elements "<<argv[2]<<std::endl;
+    return 1;
+  }
+
+  /* particle fields go up to n-1+5, which must fit in an int */
+  if(std::strcmp(kind,"ints")!=0&&n>(unsigned long long)(INT_MAX)-4){
+    std::cerr<<"too many particles "<<argv[2]<<", max is "<<INT_MAX-4
+             <<std::endl;
+    return 1;
+  }
+
+  std::ofstream out(argv[3],std::ios::binary);
+  if(!out){
+    std::cerr<<"can't open "<<argv[3]<<std::endl;
+    return 1;
+  }
+
+  static const std::size_t buffer_size=1<<16;
+
+  if(std::strcmp(kind,"particles-aos")==0){
+    std::vector<particle> buf;
+    buf.reserve(buffer_size);
+    for(std::size_t i=0;i<n;++i){
+      int x=static_cast<int>(i);
+      buf.push_back({x,x+1,x+2,x+3,x+4,x+5});
+      if(buf.size()==buffer_size)write_buffer(out,buf);
+    }
+    write_buffer(out,buf);
+  }
+  else if(std::strcmp(kind,"particles-soa")==0){
+    std::vector<int> buf;
+    buf.reserve(buffer_size);
+    for(int field=0;field<6;++field){
+      for(std::size_t i=0;i<n;++i){
+        buf.push_back(static_cast<int>(i)+field);
+        if(buf.size()==buffer_size)write_buffer(out,buf);
+      }
+    }
+    write_buffer(out,buf);
+  }
+  else{ /* ints */
+    std::mt19937                    gen;
+    std::uniform_int_distribution<> rnd(0,255);
+    std::vector<int>                buf;
+    buf.reserve(buffer_size);
+    for(std::size_t i=0;i<n;++i){
+      buf.push_back(rnd(gen));
+      if(buf.size()==buffer_size)write_buffer(out,buf);
+    }
+    write_buffer(out,buf);
+  }
+
+  if(!out){
+    std::cerr<<"error writing "<<argv[3]<<std::endl;
+    return 1;
+  }
+}
@@ -12,6 +12,9 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
         
 template<typename F>
 double measure(F f)
@@ -22,6 +25,7 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
@@ -36,6 +40,7 @@ double measure(F f)
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
   return std::accumulate(
@@ -58,35 +63,438 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
-int main()
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Read-only memory mapping of a whole file (POSIX only). */
+
+class mapped_file
+{
+public:
+  explicit mapped_file(const char* path)
+  {
+    int fd=open(path,O_RDONLY);
+    if(fd==-1)throw std::runtime_error(std::string("can't open ")+path);
+
+    struct stat st;
+    if(fstat(fd,&st)==-1){
+      close(fd);
+      throw std::runtime_error(std::string("can't stat ")+path);
+    }
+    size_=static_cast<std::size_t>(st.st_size);
+    if(size_){
+      data_=mmap(nullptr,size_,PROT_READ,MAP_PRIVATE,fd,0);
+      if(data_==MAP_FAILED){
+        close(fd);
+        throw std::runtime_error(std::string("can't map ")+path);
+      }
+    }
+    close(fd);
+  }
+
+  mapped_file(const mapped_file&)=delete;
+  mapped_file& operator=(const mapped_file&)=delete;
+
+  ~mapped_file()
+  {
+    if(size_)munmap(data_,size_);
+  }
+
+  template<typename T>
+  const T* data()const{return static_cast<const T*>(data_);}
+  std::size_t size()const{return size_;}
+
+private:
+  void*       data_=nullptr;
+  std::size_t size_=0;
+};
+
+template<typename Iterator>
+long int filtered_sum(Iterator first,Iterator last)
+{
+  long int res=0;
+  for(;first!=last;++first)if(*first>128)res+=*first;
+  return res;
+}
+
+/* Decoding of a full 128-value frame-of-reference block of width W into
+ * 32-bit offsets, with W a compile-time constant: each value is extracted
+ * from an unaligned 64-bit window starting at the byte where it begins,
+ * which always contains it whole as W<=32, so there's no branching on
+ * values straddling words (the column is padded so that windows never
+ * read past its end). Bit positions within windows assume a little-endian
+ * platform. Widths 8 and 16 are plain byte and 16-bit arrays.
+ */
+
+template<unsigned int W,unsigned int J>
+inline std::uint32_t for_unpack_value(const unsigned char* bytes)
+{
+  static const std::uint64_t mask=(std::uint64_t(1)<<W)-1;
+
+  std::uint64_t x;
+  std::memcpy(&x,bytes+J*W/8,sizeof(x));
+  return static_cast<std::uint32_t>((x>>(J*W%8))&mask);
+}
+
+template<unsigned int W>
+void for_unpack_block(const std::uint64_t* p,std::uint32_t* out)
+{
+  /* groups of 8 values take W whole bytes, so offsets within a group are
+   * compile-time constants
+   */
+  const unsigned char* bytes=reinterpret_cast<const unsigned char*>(p);
+  for(std::size_t i=0;i<128;i+=8,bytes+=W,out+=8){
+    out[0]=for_unpack_value<W,0>(bytes);
+    out[1]=for_unpack_value<W,1>(bytes);
+    out[2]=for_unpack_value<W,2>(bytes);
+    out[3]=for_unpack_value<W,3>(bytes);
+    out[4]=for_unpack_value<W,4>(bytes);
+    out[5]=for_unpack_value<W,5>(bytes);
+    out[6]=for_unpack_value<W,6>(bytes);
+    out[7]=for_unpack_value<W,7>(bytes);
+  }
+}
+
+template<>
+void for_unpack_block<0>(const std::uint64_t*,std::uint32_t* out)
+{
+  std::fill(out,out+128,0u);
+}
+
+#if defined(__SSE2__)
+/* zero-extension of bytes and 16-bit halves, 16 bytes at a time */
+
+template<>
+void for_unpack_block<8>(const std::uint64_t* p,std::uint32_t* out)
+{
+  const __m128i zero=_mm_setzero_si128();
+  for(std::size_t i=0;i<128;i+=16){
+    __m128i x=_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)+i/16),
+            lo=_mm_unpacklo_epi8(x,zero),
+            hi=_mm_unpackhi_epi8(x,zero);
+    __m128i* q=reinterpret_cast<__m128i*>(out+i);
+    _mm_storeu_si128(q,_mm_unpacklo_epi16(lo,zero));
+    _mm_storeu_si128(q+1,_mm_unpackhi_epi16(lo,zero));
+    _mm_storeu_si128(q+2,_mm_unpacklo_epi16(hi,zero));
+    _mm_storeu_si128(q+3,_mm_unpackhi_epi16(hi,zero));
+  }
+}
+
+template<>
+void for_unpack_block<16>(const std::uint64_t* p,std::uint32_t* out)
+{
+  const __m128i zero=_mm_setzero_si128();
+  for(std::size_t i=0;i<128;i+=8){
+    __m128i x=_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)+i/8);
+    __m128i* q=reinterpret_cast<__m128i*>(out+i);
+    _mm_storeu_si128(q,_mm_unpacklo_epi16(x,zero));
+    _mm_storeu_si128(q+1,_mm_unpackhi_epi16(x,zero));
+  }
+}
+#else
+template<>
+void for_unpack_block<8>(const std::uint64_t* p,std::uint32_t* out)
+{
+  const unsigned char* bytes=reinterpret_cast<const unsigned char*>(p);
+  for(std::size_t i=0;i<128;++i)out[i]=bytes[i];
+}
+
+template<>
+void for_unpack_block<16>(const std::uint64_t* p,std::uint32_t* out)
+{
+  std::uint16_t x[128];
+  std::memcpy(x,p,sizeof(x));
+  for(std::size_t i=0;i<128;++i)out[i]=x[i];
+}
+#endif
+
+/* Frame-of-reference encoding: values are split into blocks of 128, each
+ * stored as its minimum (the base) plus per-value offsets bit-packed to
+ * the width needed by the block's range. Kernels work block by block on
+ * base and offsets, and can use each block's max to skip it altogether.
+ */
+
+class for_column
+{
+public:
+  static const std::size_t block_size=128;
+
+  struct block
+  {
+    int          base,max;
+    unsigned int width;
+    std::size_t  offset; /* into words */
+  };
+
+  template<typename Iterator>
+  for_column(Iterator first,Iterator last)
+  {
+    while(first!=last){
+      Iterator    block_last=first;
+      std::size_t count=0;
+      while(block_last!=last&&count<block_size){++block_last;++count;}
+
+      auto          mm=std::minmax_element(first,block_last);
+      block         b={*mm.first,*mm.second,0,words.size()};
+      std::uint32_t range=std::uint32_t(b.max)-std::uint32_t(b.base);
+      while(b.width<32&&(range>>b.width))++b.width;
+      blocks_.push_back(b);
+
+      words.resize(words.size()+(count*b.width+63)/64,0);
+      std::uint64_t* p=words.data()+b.offset;
+      for(std::size_t pos=0;first!=block_last;++first,pos+=b.width){
+        if(!b.width)continue;
+        std::uint64_t x=std::uint32_t(*first)-std::uint32_t(b.base);
+        p[pos/64]|=x<<(pos%64);
+        if(pos%64+b.width>64)p[pos/64+1]|=x>>(64-pos%64);
+      }
+      size_+=count;
+    }
+    words.push_back(0); /* padding for for_unpack_block */
+  }
+
+  std::size_t size()const{return size_;}
+  const std::vector<block>& blocks()const{return blocks_;}
+
+  /* decodes the offsets of the first count values of block b into
+   * out[0],...,out[block_size-1], trailing positions being zero
+   */
+
+  void unpack(const block& b,std::size_t count,std::uint32_t* out)const
+  {
+    typedef void (*unpack_function)(const std::uint64_t*,std::uint32_t*);
+    static const unpack_function full_block[]={
+      &for_unpack_block<0>, &for_unpack_block<1>, &for_unpack_block<2>,
+      &for_unpack_block<3>, &for_unpack_block<4>, &for_unpack_block<5>,
+      &for_unpack_block<6>, &for_unpack_block<7>, &for_unpack_block<8>,
+      &for_unpack_block<9>, &for_unpack_block<10>,&for_unpack_block<11>,
+      &for_unpack_block<12>,&for_unpack_block<13>,&for_unpack_block<14>,
+      &for_unpack_block<15>,&for_unpack_block<16>,&for_unpack_block<17>,
+      &for_unpack_block<18>,&for_unpack_block<19>,&for_unpack_block<20>,
+      &for_unpack_block<21>,&for_unpack_block<22>,&for_unpack_block<23>,
+      &for_unpack_block<24>,&for_unpack_block<25>,&for_unpack_block<26>,
+      &for_unpack_block<27>,&for_unpack_block<28>,&for_unpack_block<29>,
+      &for_unpack_block<30>,&for_unpack_block<31>,&for_unpack_block<32>
+    };
+
+    const std::uint64_t* p=words.data()+b.offset;
+    if(count==block_size){
+      full_block[b.width](p,out);
+      return;
+    }
+
+    /* partial block (only the last one can be), value by value */
+    const std::uint64_t mask=(std::uint64_t(1)<<b.width)-1;
+    std::fill(out+count,out+block_size,0u);
+    for(std::size_t i=0,pos=0;i<count;++i,pos+=b.width){
+      if(!b.width){
+        out[i]=0;
+        continue;
+      }
+      std::uint64_t x=p[pos/64]>>(pos%64);
+      if(pos%64+b.width>64)x|=p[pos/64+1]<<(64-pos%64);
+      out[i]=static_cast<std::uint32_t>(x&mask);
+    }
+  }
+
+private:
+  std::vector<block>         blocks_;
+  std::vector<std::uint64_t> words;
+  std::size_t                size_=0;
+};
+
+/* branch-free sum of the decoded offsets above threshold: 32-bit
+ * accumulation (vectorized four lanes at a time) can't overflow for widths
+ * up to 24
+ */
+
+template<typename Accumulator>
+Accumulator sum_offsets(const std::uint32_t* buf,std::uint32_t threshold)
+{
+  Accumulator res=0;
+  for(std::size_t i=0;i<for_column::block_size;++i){
+    res+=buf[i]&(0u-std::uint32_t(buf[i]>threshold));
+  }
+  return res;
+}
+
+std::uint64_t sum_offsets(
+  unsigned int width,const std::uint32_t* buf,std::uint32_t threshold)
+{
+  if(width<=24)return sum_offsets<std::uint32_t>(buf,threshold);
+  else         return sum_offsets<std::uint64_t>(buf,threshold);
+}
+
+/* filtered sum over the first n values of a frame-of-reference column:
+ * blocks entirely at or below the threshold are skipped, the rest are
+ * decoded into a local buffer and then either summed whole, if entirely
+ * above the threshold, or summed branch-free comparing offsets against
+ * the threshold translated to the block's base.
+ */
+
+long int filtered_sum(const for_column& c,std::size_t n)
+{
+  std::uint32_t buf[for_column::block_size];
+  long int      res=0;
+  for(const auto& b:c.blocks()){
+    if(!n)break;
+    std::size_t count=n<for_column::block_size?n:for_column::block_size;
+    n-=count;
+    if(b.max<=128)continue;
+
+    /* zero padded for partial blocks, so loops run over whole buffers */
+    c.unpack(b,count,buf);
+    if(b.base>128){
+      res+=long(b.base)*long(count)+long(sum_offsets(b.width,buf,0));
+    }
+    else{
+      std::uint32_t threshold=128-b.base,selected=0;
+      for(std::size_t i=0;i<for_column::block_size;++i){
+        selected+=buf[i]>threshold;
+      }
+      res+=long(b.base)*long(selected)+
+           long(sum_offsets(b.width,buf,threshold));
+    }
+  }
+  return res;
+}
+
+/* unsorted and sorted columns over an int dataset previously written by
+ * dataset_generator: data is mapped into memory rather than synthesized,
+ * and each size step works on a prefix of the file (the sorted column
+ * needs a private copy, though).
+ */
+
+void measure_mapped(
+  const char* path,std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+{
+  mapped_file file(path);
+  const int*  p=file.data<int>();
+
+  std::cout<<"filtered sum (mapped dataset):"<<std::endl;
+  std::cout<<"n;unsorted;sorted"<<std::endl;
+
+  n1=std::min(n1,file.size()/sizeof(int));
+  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+    std::cout<<n<<";";
+    std::cout<<measure(n,[&](){return filtered_sum(p,p+n);})<<";";
+    std::vector<int> v(p,p+n);
+    std::sort(v.begin(),v.end());
+    std::cout<<measure(n,[&](){
+      return filtered_sum(v.begin(),v.end());
+    })<<"\n";
+  }
+}
+
+int main(int argc,char* argv[])
 {
   std::size_t n0=10000,n1=40000000,dn=2000;
   double      fdn=1.1;    
 
+  if(argc==2){
+    try{
+      measure_mapped(argv[1],n0,n1,dn,fdn);
+      return 0;
+    }
+    catch(const std::exception& e){
+      std::cerr<<e.what()<<std::endl;
+      return 1;
+    }
+  }
+  else if(argc!=1){
+    std::cerr<<"usage: "<<argv[0]<<" [int_dataset]"<<std::endl;
+    return 1;
+  }
+
   std::cout<<"filtered sum:"<<std::endl;
-  std::cout<<"n;unsorted;sorted"<<std::endl;
+  std::cout<<"n;unsorted;sorted;unsorted uint8;sorted uint8;"
+             "unsorted uint16;sorted uint16;unsorted for;sorted for;setup"
+           <<std::endl;
+
+  /* values are drawn once for the largest size: the first n of them are
+   * the same at every step
+   */
+  std::vector<int>                all,sorted;
+  std::mt19937                    gen;
+  std::uniform_int_distribution<> rnd(0,255);
+  all.reserve(n1);
+  sorted.reserve(n1);
+  for(std::size_t i=0;i<n1;++i)all.push_back(rnd(gen));
+
+  /* narrow and frame-of-reference encodings of the same values */
+  std::vector<std::uint8_t>  all8(all.begin(),all.end()),sorted8;
+  std::vector<std::uint16_t> all16(all.begin(),all.end()),sorted16;
+  for_column                 all_for(all.begin(),all.end());
+  sorted8.reserve(n1);
+  sorted16.reserve(n1);
     
   for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
-    std::vector<int>                v;
-    std::mt19937                    gen;
-    std::uniform_int_distribution<> rnd(0,255);
-    v.reserve(n);
-    for(std::size_t i=0;i<n;++i)v.push_back(rnd(gen));
-
-    auto f=[&](){
-      long int res=0;
-      for(int x:v)if(x>128)res+=x;
-      return res;
-    };
-
     std::cout<<n<<";";
-    std::cout<<measure(n,f)<<";";
-    std::sort(v.begin(),v.end());
-    std::cout<<measure(n,f)<<"\n";
+    std::cout<<measure(n,[&](){
+      return filtered_sum(all.begin(),all.begin()+n);
+    })<<";";
+
+    /* counting sort, same result as std::sort for values in [0,255] */
+    std::array<std::size_t,256> counts={{}};
+    for(std::size_t i=0;i<n;++i)++counts[all[i]];
+    sorted.clear();
+    sorted8.clear();
+    sorted16.clear();
+    for(int x=0;x<256;++x){
+      sorted.insert(sorted.end(),counts[x],x);
+      sorted8.insert(sorted8.end(),counts[x],std::uint8_t(x));
+      sorted16.insert(sorted16.end(),counts[x],std::uint16_t(x));
+    }
+    for_column sorted_for(sorted.begin(),sorted.end());
+
+    std::cout<<measure(n,[&](){
+      return filtered_sum(sorted.begin(),sorted.end());
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return filtered_sum(all8.begin(),all8.begin()+n);
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return filtered_sum(sorted8.begin(),sorted8.end());
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return filtered_sum(all16.begin(),all16.begin()+n);
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return filtered_sum(sorted16.begin(),sorted16.end());
+    })<<";";
+    std::cout<<measure(n,[&](){return filtered_sum(all_for,n);})<<";";
+    std::cout<<measure(n,[&](){return filtered_sum(sorted_for,n);})<<";";
+    std::cout<<setup_time()<<"\n";
   }
 }
@@ -0,0 +1,351 @@
+/* usingstdcpp2015: AOS vs SOA vs AOSOA over a matrix of element types,
+ * record sizes and access patterns.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+ 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric> 
+    
+std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
+        
+template<typename F>
+double measure(F f)
+{
+  using namespace std::chrono;
+        
+  static const int              num_trials=10;
+  static const milliseconds     min_time_per_trial(200);
+  std::array<double,num_trials> trials;
+  volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
+        
+  for(int i=0;i<num_trials;++i){
+    int                               runs=0;
+    high_resolution_clock::time_point t2;
+        
+    measure_start=high_resolution_clock::now();
+    do{
+      res=f();
+      ++runs;
+      t2=high_resolution_clock::now();
+    }while(t2-measure_start<min_time_per_trial);
+    trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+  }
+  (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
+        
+  std::sort(trials.begin(),trials.end());
+  return std::accumulate(
+    trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+}
+ 
+template<typename Size,typename F>
+double measure(Size n,F f)
+{
+  return measure(f)/n;
+}
+
+void pause_timing()
+{
+  measure_pause=std::chrono::high_resolution_clock::now();
+}
+        
+void resume_timing()
+{
+  measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
+}
+
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Particles with Fields fields of type T, of which kernels read the first
+ * three (x, y, z), laid out as:
+ *   - aos: an array of records,
+ *   - soa: an array per field,
+ *   - aosoa: an array of blocks, each holding a cache line's worth of
+ *     consecutive values (64/sizeof(T) of them) per field.
+ * Field f of the i-th particle is initialized to T(i+f).
+ */
+
+template<typename T,std::size_t Fields>
+struct aos_layout
+{
+  static const char* name(){return "aos";}
+
+  struct record
+  {
+    T field[Fields];
+  };
+
+  explicit aos_layout(std::size_t n):records(n)
+  {
+    for(std::size_t i=0;i<n;++i){
+      for(std::size_t f=0;f<Fields;++f)records[i].field[f]=T(i+f);
+    }
+  }
+
+  T x(std::size_t i)const{return records[i].field[0];}
+  T y(std::size_t i)const{return records[i].field[1];}
+  T z(std::size_t i)const{return records[i].field[2];}
+
+  std::vector<record> records;
+};
+
+template<typename T,std::size_t Fields>
+struct soa_layout
+{
+  static const char* name(){return "soa";}
+
+  explicit soa_layout(std::size_t n)
+  {
+    for(std::size_t f=0;f<Fields;++f){
+      fields[f].reserve(n);
+      for(std::size_t i=0;i<n;++i)fields[f].push_back(T(i+f));
+    }
+  }
+
+  T x(std::size_t i)const{return fields[0][i];}
+  T y(std::size_t i)const{return fields[1][i];}
+  T z(std::size_t i)const{return fields[2][i];}
+
+  std::array<std::vector<T>,Fields> fields;
+};
+
+template<typename T,std::size_t Fields>
+struct aosoa_layout
+{
+  static const char* name(){return "aosoa";}
+
+  static const std::size_t lanes=64/sizeof(T);
+
+  struct block
+  {
+    T field[Fields][lanes];
+  };
+
+  explicit aosoa_layout(std::size_t n):blocks((n+lanes-1)/lanes)
+  {
+    for(std::size_t i=0;i<n;++i){
+      for(std::size_t f=0;f<Fields;++f){
+        blocks[i/lanes].field[f][i%lanes]=T(i+f);
+      }
+    }
+  }
+
+  T x(std::size_t i)const{return blocks[i/lanes].field[0][i%lanes];}
+  T y(std::size_t i)const{return blocks[i/lanes].field[1][i%lanes];}
+  T z(std::size_t i)const{return blocks[i/lanes].field[2][i%lanes];}
+
+  std::vector<block> blocks;
+};
+
+/* integral values are summed as long ints, floating point ones as doubles */
+
+template<typename T>
+using accumulator=typename std::conditional<
+  std::is_floating_point<T>::value,double,long int>::type;
+
+template<typename T>
+const char* type_name();
+
+template<> const char* type_name<std::int8_t>(){return "int8";}
+template<> const char* type_name<std::int16_t>(){return "int16";}
+template<> const char* type_name<std::int32_t>(){return "int32";}
+template<> const char* type_name<std::int64_t>(){return "int64";}
+template<> const char* type_name<float>(){return "float";}
+template<> const char* type_name<double>(){return "double";}
+
+/* Access patterns: sequential traversal of the first n particles, and n
+ * accesses at random positions among them. The sequential kernel is
+ * specialized for aosoa so as to walk block by block rather than
+ * computing block and lane for each particle.
+ */
+
+struct sequential
+{
+  static const char* name(){return "sequential";}
+
+  template<template<typename,std::size_t> class Layout,
+           typename T,std::size_t Fields>
+  static accumulator<T> sum(const Layout<T,Fields>& ps,std::size_t n)
+  {
+    accumulator<T> res=0;
+    for(std::size_t i=0;i<n;++i)res+=ps.x(i)+ps.y(i)+ps.z(i);
+    return res;
+  }
+
+  template<typename T,std::size_t Fields>
+  static accumulator<T> sum(const aosoa_layout<T,Fields>& ps,std::size_t n)
+  {
+    using layout=aosoa_layout<T,Fields>;
+
+    accumulator<T> res=0;
+    for(std::size_t i=0;i<n;i+=layout::lanes){
+      const auto& b=ps.blocks[i/layout::lanes];
+      std::size_t m=n-i<layout::lanes?n-i:layout::lanes;
+      for(std::size_t j=0;j<m;++j){
+        res+=b.field[0][j]+b.field[1][j]+b.field[2][j];
+      }
+    }
+    return res;
+  }
+};
+
+struct random_access
+{
+  static const char* name(){return "random";}
+
+  template<typename Layout>
+  static auto sum(const Layout& ps,std::size_t n)->decltype(
+    sequential::sum(ps,n))
+  {
+    std::mt19937                    gen;
+    std::uniform_int_distribution<> rnd(0,n-1);
+    decltype(sequential::sum(ps,n)) res=0;
+    for(std::size_t i=0;i<n;++i){
+      auto idx=rnd(gen);
+      res+=ps.x(idx)+ps.y(idx)+ps.z(idx);
+    }
+    return res;
+  }
+};
+
+/* Size sweep measured column by column rather than row by row, so that
+ * each column can build its data once for the largest size, work on
+ * prefixes and release it before the next column starts: only one
+ * column's data is in memory at any time. Rows are printed at the end;
+ * the setup column adds up, for each size, the time spent outside
+ * measure() right before each of its measurements (building a column's
+ * data thus shows up in the first row).
+ */
+
+class size_sweep
+{
+public:
+  size_sweep(std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+  {
+    for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+      sizes.push_back(n);
+    }
+    rows.resize(sizes.size());
+    setup_times.resize(sizes.size());
+  }
+
+  /* f(n) is measured for every size n, after prepare(n) if given */
+
+  template<typename F>
+  void column(F f)
+  {
+    column([](std::size_t){},f);
+  }
+
+  template<typename Prepare,typename F>
+  void column(Prepare prepare,F f)
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::size_t        n=sizes[i];
+      std::ostringstream os;
+      prepare(n);
+      setup_times[i]+=setup_time();
+      os<<measure(n,[&](){return f(n);})<<";";
+      rows[i]+=os.str();
+    }
+  }
+
+  void print(const std::string& prefix) /* prefix goes before n */
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::cout<<prefix<<sizes[i]<<";"<<rows[i]<<setup_times[i]<<"\n";
+    }
+  }
+
+private:
+  std::vector<std::size_t> sizes;
+  std::vector<std::string> rows;
+  std::vector<double>      setup_times;
+};
+
+/* Rows for a given element type and field count: each layout is built
+ * once for the largest size, measured for both access patterns over the
+ * whole size sweep and destroyed before the next one, so that only one of
+ * them is in memory at any time.
+ */
+
+template<template<typename,std::size_t> class Layout,
+         typename T,std::size_t Fields>
+void measure_layout(size_sweep& seq,size_sweep& rnd,std::size_t n1)
+{
+  Layout<T,Fields> ps(n1);
+  seq.column([&](std::size_t n){return sequential::sum(ps,n);});
+  rnd.column([&](std::size_t n){return random_access::sum(ps,n);});
+}
+
+template<typename T,std::size_t Fields>
+void measure_rows(const size_sweep& sweep,std::size_t n1)
+{
+  size_sweep seq(sweep),rnd(sweep);
+  measure_layout<aos_layout,T,Fields>(seq,rnd,n1);
+  measure_layout<soa_layout,T,Fields>(seq,rnd,n1);
+  measure_layout<aosoa_layout,T,Fields>(seq,rnd,n1);
+
+  std::string prefix=std::string(type_name<T>())+";"+
+    std::to_string(Fields)+";";
+  seq.print(prefix+sequential::name()+";");
+  rnd.print(prefix+random_access::name()+";");
+}
+
+template<typename T,std::size_t... Fields>
+void measure_fields(const size_sweep& sweep,std::size_t n1)
+{
+  (measure_rows<T,Fields>(sweep,n1),...);
+}
+
+template<typename... Ts>
+void measure_types(const size_sweep& sweep,std::size_t n1)
+{
+  /* 3 fields as in compact_aos_vs_soa.cpp, 6 as in aos_vs_soa.cpp */
+  (measure_fields<Ts,3,6,16>(sweep,n1),...);
+}
+
+int main()
+{
+  std::size_t n0=10000,n1=10000000,dn=2000;
+  double      fdn=1.1;    
+
+  std::cout<<"aos vs soa vs aosoa:"<<std::endl;
+  std::cout<<"type;fields;access;n;aos;soa;aosoa;setup"<<std::endl;
+
+  measure_types<
+    std::int8_t,std::int16_t,std::int32_t,std::int64_t,
+    float,double>(size_sweep(n0,n1,dn,fdn),n1);
+}
@@ -12,6 +12,9 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
         
 template<typename F>
 double measure(F f)
@@ -22,6 +25,7 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
@@ -36,6 +40,7 @@ double measure(F f)
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
   return std::accumulate(
@@ -58,47 +63,658 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
 #include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <numeric>
 #include <list>
+#include <memory>
+#include <queue>
 #include <random>
+#include <sstream>
+#include <string>
+#include <utility>
 #include <vector>
 
+/* Unrolled linked list: each node holds up to N elements, so traversal
+ * touches one node header every N elements and the elements themselves
+ * are contiguous within a node. Only what's needed for the benchmark
+ * (push_back and forward iteration) is provided.
+ */
+
+template<typename T,std::size_t N=64>
+class unrolled_list
+{
+  struct node
+  {
+    node*            next=nullptr;
+    std::size_t      size=0;
+    std::array<T,N>  data;
+  };
+
+public:
+  class iterator
+  {
+  public:
+    using iterator_category=std::forward_iterator_tag;
+    using value_type=T;
+    using difference_type=std::ptrdiff_t;
+    using pointer=T*;
+    using reference=T&;
+
+    iterator(node* pn=nullptr,std::size_t i=0):pn(pn),i(i){}
+
+    T& operator*()const{return pn->data[i];}
+    T* operator->()const{return &pn->data[i];}
+
+    iterator& operator++()
+    {
+      if(++i==pn->size){pn=pn->next;i=0;}
+      return *this;
+    }
+
+    iterator operator++(int){iterator tmp=*this;++*this;return tmp;}
+
+    friend bool operator==(const iterator& x,const iterator& y)
+      {return x.pn==y.pn&&x.i==y.i;}
+    friend bool operator!=(const iterator& x,const iterator& y)
+      {return !(x==y);}
+
+  private:
+    node*       pn;
+    std::size_t i;
+  };
+
+  unrolled_list()=default;
+  unrolled_list(const unrolled_list&)=delete;
+  unrolled_list& operator=(const unrolled_list&)=delete;
+
+  ~unrolled_list()
+  {
+    while(head){
+      node* next=head->next;
+      delete head;
+      head=next;
+    }
+  }
+
+  void push_back(const T& x)
+  {
+    if(!tail||tail->size==N){
+      node* pn=new node;
+      if(tail)tail->next=pn;
+      else    head=pn;
+      tail=pn;
+    }
+    tail->data[tail->size++]=x;
+  }
+
+  iterator begin(){return iterator(head);}
+  iterator end(){return iterator();}
+
+private:
+  node* head=nullptr;
+  node* tail=nullptr;
+};
+
+/* Memory pool handing out chunks carved sequentially from large
+ * contiguous blocks, with per-size free lists for reuse. Nodes allocated
+ * in a row end up adjacent in memory regardless of what else the program
+ * does with the global heap.
+ */
+
+class node_pool
+{
+public:
+  explicit node_pool(std::size_t block_size=1<<20):block_size(block_size){}
+  node_pool(const node_pool&)=delete;
+  node_pool& operator=(const node_pool&)=delete;
+
+  ~node_pool()
+  {
+    for(auto p:blocks)::operator delete(p);
+  }
+
+  void* allocate(std::size_t size)
+  {
+    size=round_up(size);
+    if(size>block_size/4)return ::operator new(size);
+
+    std::size_t slot=size/alignment;
+    if(slot<free_lists.size()&&free_lists[slot]){
+      void* p=free_lists[slot];
+      free_lists[slot]=*static_cast<void**>(p);
+      return p;
+    }
+    if(static_cast<std::size_t>(last-first)<size){
+      first=static_cast<char*>(::operator new(block_size));
+      last=first+block_size;
+      blocks.push_back(first);
+    }
+    void* p=first;
+    first+=size;
+    return p;
+  }
+
+  void deallocate(void* p,std::size_t size)
+  {
+    size=round_up(size);
+    if(size>block_size/4){
+      ::operator delete(p);
+      return;
+    }
+
+    std::size_t slot=size/alignment;
+    if(slot>=free_lists.size())free_lists.resize(slot+1,nullptr);
+    *static_cast<void**>(p)=free_lists[slot];
+    free_lists[slot]=p;
+  }
+
+private:
+  static const std::size_t alignment=alignof(std::max_align_t);
+
+  static std::size_t round_up(std::size_t size)
+  {
+    return (size+alignment-1)/alignment*alignment;
+  }
+
+  std::size_t        block_size;
+  std::vector<void*> blocks;
+  std::vector<void*> free_lists;
+  char*              first=nullptr;
+  char*              last=nullptr;
+};
+
+template<typename T>
+class pool_allocator
+{
+public:
+  using value_type=T;
+
+  explicit pool_allocator(node_pool& pool):pool(&pool){}
+  template<typename U>
+  pool_allocator(const pool_allocator<U>& x):pool(x.pool){}
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(pool->allocate(n*sizeof(T)));
+  }
+
+  void deallocate(T* p,std::size_t n)
+  {
+    pool->deallocate(p,n*sizeof(T));
+  }
+
+  template<typename U>
+  friend bool operator==(const pool_allocator& x,const pool_allocator<U>& y)
+    {return x.pool==y.pool;}
+  template<typename U>
+  friend bool operator!=(const pool_allocator& x,const pool_allocator<U>& y)
+    {return x.pool!=y.pool;}
+
+private:
+  template<typename> friend class pool_allocator;
+
+  node_pool* pool;
+};
+
+/* Monotonic arena: memory is bump-allocated from large contiguous blocks
+ * and only given back when the arena is destroyed, so objects allocated
+ * in sequence lie next to each other.
+ */
+
+class monotonic_arena
+{
+public:
+  explicit monotonic_arena(std::size_t block_size=1<<20):
+    block_size(block_size){}
+  monotonic_arena(const monotonic_arena&)=delete;
+  monotonic_arena& operator=(const monotonic_arena&)=delete;
+
+  ~monotonic_arena()
+  {
+    for(auto p:blocks)::operator delete(p);
+  }
+
+  void* allocate(std::size_t size,std::size_t align)
+  {
+    std::size_t pad=(align-reinterpret_cast<std::uintptr_t>(first)%align)%align;
+    if(!first||static_cast<std::size_t>(last-first)<pad+size){
+      std::size_t bs=std::max(block_size,size+align);
+      first=static_cast<char*>(::operator new(bs));
+      last=first+bs;
+      blocks.push_back(first);
+      pad=(align-reinterpret_cast<std::uintptr_t>(first)%align)%align;
+    }
+    void* p=first+pad;
+    first+=pad+size;
+    return p;
+  }
+
+  void deallocate(void*,std::size_t){}
+
+private:
+  std::size_t        block_size;
+  std::vector<void*> blocks;
+  char*              first=nullptr;
+  char*              last=nullptr;
+};
+
+template<typename T>
+class arena_allocator
+{
+public:
+  using value_type=T;
+
+  explicit arena_allocator(monotonic_arena& arena):arena(&arena){}
+  template<typename U>
+  arena_allocator(const arena_allocator<U>& x):arena(x.arena){}
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(arena->allocate(n*sizeof(T),alignof(T)));
+  }
+
+  void deallocate(T* p,std::size_t n)
+  {
+    arena->deallocate(p,n*sizeof(T));
+  }
+
+  template<typename U>
+  friend bool operator==(const arena_allocator& x,const arena_allocator<U>& y)
+    {return x.arena==y.arena;}
+  template<typename U>
+  friend bool operator!=(const arena_allocator& x,const arena_allocator<U>& y)
+    {return x.arena!=y.arena;}
+
+private:
+  template<typename> friend class arena_allocator;
+
+  monotonic_arena* arena;
+};
+
+/* Allocates n blocks of the given size and frees a random half of them,
+ * leaving the global heap riddled with holes that subsequent allocations
+ * of similar size will be served from in no particular order. The
+ * surviving blocks are returned so that the caller decides when the heap
+ * is cleaned up.
+ */
+
+std::vector<std::unique_ptr<char[]>> fragment_heap(
+  std::size_t n,std::size_t size)
+{
+  std::mt19937                         gen(34862);
+  std::vector<std::unique_ptr<char[]>> blocks;
+  blocks.reserve(n);
+  for(std::size_t i=0;i<n;++i)blocks.emplace_back(new char[size]);
+  std::shuffle(blocks.begin(),blocks.end(),gen);
+  blocks.resize(n/2);
+  return blocks;
+}
+
+/* Heap aging: simulates the allocation history of a long running process
+ * by performing a number of allocations with sizes drawn from a given mix
+ * and exponentially distributed lifetimes (measured in allocations), a
+ * fraction of them living on past the aging phase. When aging finishes,
+ * a fraction of the short lived blocks still pending is freed in random
+ * order, leaving holes scattered among the survivors; the rest are kept
+ * until the aged_heap object is destroyed, so that whatever is allocated
+ * in between sees a realistically fragmented heap.
+ */
+
+struct heap_aging_profile
+{
+  std::vector<std::size_t> sizes;         /* block sizes */
+  std::vector<double>      weights;       /* relative frequency of sizes */
+  double                   mean_lifetime; /* in number of allocations */
+  double                   long_lived;    /* fraction surviving aging */
+  double                   released;      /* fraction of pending blocks
+                                           * freed at the end of aging */
+};
+
+class aged_heap
+{
+public:
+  aged_heap(const heap_aging_profile& profile,std::size_t steps)
+  {
+    using death=std::pair<std::size_t,char*>;
+
+    std::mt19937                                gen(73541);
+    std::discrete_distribution<std::size_t>     size_index(
+      profile.weights.begin(),profile.weights.end());
+    std::exponential_distribution<>             lifetime(
+      1.0/profile.mean_lifetime);
+    std::bernoulli_distribution                 survives(profile.long_lived);
+    std::priority_queue<
+      death,std::vector<death>,std::greater<death>> pending;
+
+    for(std::size_t i=0;i<steps;++i){
+      while(!pending.empty()&&pending.top().first<=i){
+        delete[] pending.top().second;
+        pending.pop();
+      }
+      char* p=new char[profile.sizes[size_index(gen)]];
+      if(survives(gen))live.push_back(p);
+      else pending.push(death(i+1+std::size_t(lifetime(gen)),p));
+    }
+
+    std::vector<char*> rest;
+    for(;!pending.empty();pending.pop())rest.push_back(pending.top().second);
+    std::shuffle(rest.begin(),rest.end(),gen);
+    std::size_t        num_released=std::size_t(profile.released*rest.size());
+    for(std::size_t i=0;i<rest.size();++i){
+      if(i<num_released)delete[] rest[i];
+      else              live.push_back(rest[i]);
+    }
+  }
+
+  aged_heap(const aged_heap&)=delete;
+  aged_heap& operator=(const aged_heap&)=delete;
+
+  ~aged_heap()
+  {
+    for(auto p:live)delete[] p;
+  }
+
+private:
+  std::vector<char*> live;
+};
+
+/* Average distance in bytes between the addresses of consecutive elements
+ * of a sequence: sizeof(value_type) for a contiguous sequence, growing as
+ * locality degrades.
+ */
+
+template<typename Iterator>
+double locality_score(Iterator first,Iterator last)
+{
+  if(first==last)return 0.0;
+
+  double         total=0.0;
+  std::size_t    count=0;
+  std::uintptr_t prev=reinterpret_cast<std::uintptr_t>(&*first);
+  while(++first!=last){
+    std::uintptr_t addr=reinterpret_cast<std::uintptr_t>(&*first);
+    total+=addr>prev?addr-prev:prev-addr;
+    prev=addr;
+    ++count;
+  }
+  return count?total/count:0.0;
+}
+
+/* Relinks the nodes of l so that traversal follows increasing memory
+ * addresses. No element is copied or moved, so iterators and references
+ * stay valid, but sequence order is changed.
+ */
+
+template<typename T,typename Allocator>
+void relink_in_memory_order(std::list<T,Allocator>& l)
+{
+  using iterator=typename std::list<T,Allocator>::iterator;
+
+  std::vector<iterator> its;
+  its.reserve(l.size());
+  for(auto it=l.begin();it!=l.end();++it)its.push_back(it);
+  std::sort(its.begin(),its.end(),[](iterator x,iterator y){
+    return std::less<const T*>()(&*x,&*y);
+  });
+  for(auto it:its)l.splice(l.end(),l,it);
+}
+
+/* Size sweep measured column by column rather than row by row, so that
+ * each column can build its data once for the largest size, work on
+ * prefixes and release it before the next column starts: only one
+ * column's data is in memory at any time. Rows are printed at the end;
+ * the setup column adds up, for each size, the time spent outside
+ * measure() right before each of its measurements (building a column's
+ * data thus shows up in the first row).
+ */
+
+class size_sweep
+{
+public:
+  size_sweep(std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+  {
+    for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+      sizes.push_back(n);
+    }
+    rows.resize(sizes.size());
+    setup_times.resize(sizes.size());
+  }
+
+  /* f(n) is measured for every size n, after prepare(n) if given */
+
+  template<typename F>
+  void column(F f)
+  {
+    column([](std::size_t){},f);
+  }
+
+  template<typename Prepare,typename F>
+  void column(Prepare prepare,F f)
+  {
+    column(prepare,f,nullptr);
+  }
+
+  /* same, with report(n) printed as an extra column after each measurement */
+
+  template<typename Prepare,typename F,typename Report>
+  void column(Prepare prepare,F f,Report report)
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::size_t        n=sizes[i];
+      std::ostringstream os;
+      prepare(n);
+      setup_times[i]+=setup_time();
+      os<<measure(n,[&](){return f(n);})<<";";
+      print_report(os,report,n);
+      rows[i]+=os.str();
+    }
+  }
+
+  void print()
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::cout<<sizes[i]<<";"<<rows[i]<<setup_times[i]<<"\n";
+    }
+  }
+
+private:
+  static void print_report(std::ostream&,std::nullptr_t,std::size_t){}
+
+  template<typename Report>
+  static void print_report(std::ostream& os,Report report,std::size_t n)
+  {
+    os<<report(n)<<";";
+  }
+
+  std::vector<std::size_t> sizes;
+  std::vector<std::string> rows;
+  std::vector<double>      setup_times;
+};
+
 int main()
 {
   std::size_t n0=10000,n1=40000000,dn=2000;
   double      fdn=1.1;    
 
   std::cout<<"linear traversal:"<<std::endl;
-  std::cout<<"n;vector;list;shuffled list"<<std::endl;
-    
-  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
-    std::cout<<n<<";";
-    {
-      std::vector<int> v(n);
-      std::iota(v.begin(),v.end(),0);
-      std::cout<<measure(n,[&](){
-        return std::accumulate(v.begin(),v.end(),0);
-      })<<";";
-    }
-    {
-      std::list<int> l(n);
+  std::cout<<"n;vector;list;list locality;"
+             "shuffled list;shuffled list locality;unrolled list;"
+             "pooled list;pooled shuffled list;relinked shuffled list;"
+             "arena list;fragmented list;fragmented arena list;"
+             "aged list;aged list locality;setup"
+           <<std::endl;
+
+  /* Columns are measured one at a time, so only one structure is alive.
+   * The vector is created once for the largest size and steps work on
+   * prefixes of it; pooled and arena lists grow from one step to the next,
+   * which their allocators guarantee to be the same as building them from
+   * scratch. Lists taking nodes from the global heap are rebuilt at each
+   * step, as they would otherwise pick up memory freed in between.
+   */
+  using pooled_list=std::list<int,pool_allocator<int>>;
+  using arena_list=std::list<int,arena_allocator<int>>;
+
+  size_sweep sweep(n0,n1,dn,fdn);
+  {
+    std::vector<int> v(n1);
+    std::iota(v.begin(),v.end(),0);
+    sweep.column([&](std::size_t n){
+      return std::accumulate(v.begin(),v.begin()+n,0);
+    });
+  }
+  {
+    std::list<int> l;
+    sweep.column([&](std::size_t n){
+      l.clear();
+      l.resize(n);
       std::iota(l.begin(),l.end(),0);
-      std::cout<<measure(n,[&](){
-        return std::accumulate(l.begin(),l.end(),0);
-      })<<";";
-    }
-    {
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    },[&](std::size_t){
+      return locality_score(l.begin(),l.end());
+    });
+  }
+  {
+    std::list<int> l;
+    sweep.column([&](std::size_t n){
       std::mt19937                    gen;
       std::uniform_int_distribution<> rnd(0,n-1);
-      std::list<int>                  l;
+      l.clear();
       for(std::size_t i=0;i<n;++i)l.push_back(rnd(gen));
       l.sort();
       std::iota(l.begin(),l.end(),0);
-      std::cout<<measure(n,[&](){
-        return std::accumulate(l.begin(),l.end(),0);
-      })<<"\n";
-    }
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    },[&](std::size_t){
+      return locality_score(l.begin(),l.end());
+    });
+  }
+  {
+    std::unique_ptr<unrolled_list<int>> l;
+    sweep.column([&](std::size_t n){
+      l.reset();
+      l.reset(new unrolled_list<int>);
+      for(std::size_t i=0;i<n;++i)l->push_back(i);
+    },[&](std::size_t){
+      return std::accumulate(l->begin(),l->end(),0);
+    });
+  }
+  {
+    node_pool   pool;
+    pooled_list l{pool_allocator<int>(pool)};
+    sweep.column([&](std::size_t n){
+      for(std::size_t i=l.size();i<n;++i)l.push_back(i);
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    });
+  }
+  {
+    std::unique_ptr<node_pool>   pool;
+    std::unique_ptr<pooled_list> l;
+    sweep.column([&](std::size_t n){
+      std::mt19937                    gen;
+      std::uniform_int_distribution<> rnd(0,n-1);
+      l.reset();
+      pool.reset(new node_pool);
+      l.reset(new pooled_list{pool_allocator<int>(*pool)});
+      for(std::size_t i=0;i<n;++i)l->push_back(rnd(gen));
+      l->sort();
+      std::iota(l->begin(),l->end(),0);
+    },[&](std::size_t){
+      return std::accumulate(l->begin(),l->end(),0);
+    });
+  }
+  {
+    std::list<int> l;
+    sweep.column([&](std::size_t n){
+      std::mt19937                    gen;
+      std::uniform_int_distribution<> rnd(0,n-1);
+      l.clear();
+      for(std::size_t i=0;i<n;++i)l.push_back(rnd(gen));
+      l.sort();
+      relink_in_memory_order(l);
+      std::iota(l.begin(),l.end(),0);
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    });
+  }
+  {
+    monotonic_arena arena;
+    arena_list      l{arena_allocator<int>(arena)};
+    sweep.column([&](std::size_t n){
+      for(std::size_t i=l.size();i<n;++i)l.push_back(i);
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    });
+  }
+  {
+    std::list<int> l;
+    sweep.column([&](std::size_t n){
+      l.clear();
+      auto holes=fragment_heap(n,sizeof(int)+2*sizeof(void*));
+      l.resize(n);
+      holes.clear();
+      std::iota(l.begin(),l.end(),0);
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    });
+  }
+  {
+    std::unique_ptr<monotonic_arena> arena;
+    std::unique_ptr<arena_list>      l;
+    sweep.column([&](std::size_t n){
+      l.reset();
+      arena.reset();
+      auto holes=fragment_heap(n,sizeof(int)+2*sizeof(void*));
+      arena.reset(new monotonic_arena);
+      l.reset(new arena_list(n,0,arena_allocator<int>(*arena)));
+      holes.clear();
+      std::iota(l->begin(),l->end(),0);
+    },[&](std::size_t){
+      return std::accumulate(l->begin(),l->end(),0);
+    });
+  }
+  {
+    /* mostly small blocks, a quarter of which are long lived, half of
+     * the pending ones released when aging ends
+     */
+    std::list<int>             l;
+    std::unique_ptr<aged_heap> heap;
+    sweep.column([&](std::size_t n){
+      l.clear();
+      heap.reset();
+      heap_aging_profile profile={
+        {16,24,32,48,64,128,256},{8,16,8,4,4,2,1},double(n)/4,0.25,0.5};
+      heap.reset(new aged_heap(profile,2*n));
+      l.resize(n);
+      std::iota(l.begin(),l.end(),0);
+    },[&](std::size_t){
+      return std::accumulate(l.begin(),l.end(),0);
+    },[&](std::size_t){
+      return locality_score(l.begin(),l.end());
+    });
   }
+  sweep.print();
 }
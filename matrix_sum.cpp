@@ -12,6 +12,9 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
         
 template<typename F>
 double measure(F f)
@@ -22,6 +25,7 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
@@ -36,6 +40,7 @@ double measure(F f)
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
   return std::accumulate(
@@ -58,50 +63,510 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
 #include <algorithm>
+#include <atomic>
 #include <boost/multi_array.hpp>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
-int main()
+/* Allocator obtaining memory directly from mmap with a given page policy
+ * (Linux only):
+ *   - small_pages: 4KB pages, transparent huge pages explicitly disabled,
+ *   - transparent_huge_pages: 2MB-aligned region with madvise(MADV_HUGEPAGE),
+ *   - huge_pages_2mb, huge_pages_1gb: hugetlbfs pages, which must have
+ *     been reserved beforehand (e.g. through /proc/sys/vm/nr_hugepages);
+ *     std::bad_alloc is thrown otherwise.
+ */
+
+enum class page_policy
+{
+  small_pages,transparent_huge_pages,huge_pages_2mb,huge_pages_1gb
+};
+
+template<typename T,page_policy Policy>
+class page_allocator
+{
+public:
+  using value_type=T;
+
+  template<typename U>
+  struct rebind{using other=page_allocator<U,Policy>;};
+
+  page_allocator()=default;
+  template<typename U>
+  page_allocator(const page_allocator<U,Policy>&){}
+
+  T* allocate(std::size_t n)
+  {
+    std::size_t size=mapping_size(n);
+    int         flags=MAP_PRIVATE|MAP_ANONYMOUS;
+    if(Policy==page_policy::huge_pages_2mb)
+      flags|=MAP_HUGETLB|(21<<MAP_HUGE_SHIFT);
+    else if(Policy==page_policy::huge_pages_1gb)
+      flags|=MAP_HUGETLB|(30<<MAP_HUGE_SHIFT);
+    else if(Policy==page_policy::transparent_huge_pages)
+      size+=page_size(); /* room for aligning to a huge page boundary */
+
+    void* p=mmap(nullptr,size,PROT_READ|PROT_WRITE,flags,-1,0);
+    if(p==MAP_FAILED)throw std::bad_alloc();
+
+    if(Policy==page_policy::small_pages){
+      madvise(p,size,MADV_NOHUGEPAGE);
+    }
+    else if(Policy==page_policy::transparent_huge_pages){
+      char*       first=static_cast<char*>(p);
+      std::size_t head=(page_size()-
+        reinterpret_cast<std::uintptr_t>(first)%page_size())%page_size();
+      if(head)munmap(first,head);
+      munmap(first+head+mapping_size(n),page_size()-head);
+      p=first+head;
+      madvise(p,mapping_size(n),MADV_HUGEPAGE);
+    }
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p,std::size_t n)
+  {
+    munmap(p,mapping_size(n));
+  }
+
+  template<typename U>
+  friend bool operator==(const page_allocator&,const page_allocator<U,Policy>&)
+    {return true;}
+  template<typename U>
+  friend bool operator!=(const page_allocator&,const page_allocator<U,Policy>&)
+    {return false;}
+
+private:
+  static std::size_t page_size()
+  {
+    switch(Policy){
+      case page_policy::small_pages:            return 4096;
+      case page_policy::transparent_huge_pages:
+      case page_policy::huge_pages_2mb:         return std::size_t(1)<<21;
+      case page_policy::huge_pages_1gb:
+      default:                                  return std::size_t(1)<<30;
+    }
+  }
+
+  static std::size_t mapping_size(std::size_t n)
+  {
+    std::size_t size=n*sizeof(T);
+    return (size+page_size()-1)/page_size()*page_size();
+  }
+};
+
+/* Read-only memory mapping of a whole file (POSIX only). */
+
+class mapped_file
+{
+public:
+  explicit mapped_file(const char* path)
+  {
+    int fd=open(path,O_RDONLY);
+    if(fd==-1)throw std::runtime_error(std::string("can't open ")+path);
+
+    struct stat st;
+    if(fstat(fd,&st)==-1){
+      close(fd);
+      throw std::runtime_error(std::string("can't stat ")+path);
+    }
+    size_=static_cast<std::size_t>(st.st_size);
+    if(size_){
+      data_=mmap(nullptr,size_,PROT_READ,MAP_PRIVATE,fd,0);
+      if(data_==MAP_FAILED){
+        close(fd);
+        throw std::runtime_error(std::string("can't map ")+path);
+      }
+    }
+    close(fd);
+  }
+
+  mapped_file(const mapped_file&)=delete;
+  mapped_file& operator=(const mapped_file&)=delete;
+
+  ~mapped_file()
+  {
+    if(size_)munmap(data_,size_);
+  }
+
+  template<typename T>
+  const T* data()const{return static_cast<const T*>(data_);}
+  std::size_t size()const{return size_;}
+
+private:
+  void*       data_=nullptr;
+  std::size_t size_=0;
+};
+
+template<typename Matrix>
+void fill_matrix(Matrix& a,std::size_t m)
+{
+  for(std::size_t i=0;i<m;++i){
+    for(std::size_t j=0;j<m;++j){
+      a[i][j]=i+j;
+    }
+  }
+}
+
+template<typename Matrix>
+long int sum_row_col(const Matrix& a,std::size_t m)
+{
+  long int res=0;
+  for(std::size_t i=0;i<m;++i){
+    for(std::size_t j=0;j<m;++j){
+      res+=a[i][j];
+    }
+  }
+  return res;
+}
+
+template<typename Matrix>
+long int sum_col_row(const Matrix& a,std::size_t m)
+{
+  long int res=0;
+  for(std::size_t j=0;j<m;++j){
+    for(std::size_t i=0;i<m;++i){
+      res+=a[i][j];
+    }
+  }
+  return res;
+}
+
+/* CPUs the process is allowed to run on (Linux only), empty if they can't
+ * be retrieved.
+ */
+
+std::vector<int> allowed_cpus()
+{
+  std::vector<int> res;
+  cpu_set_t        cpus;
+  if(sched_getaffinity(0,sizeof(cpu_set_t),&cpus)!=0)return res;
+
+  for(int cpu=0;cpu<CPU_SETSIZE;++cpu){
+    if(CPU_ISSET(cpu,&cpus))res.push_back(cpu);
+  }
+  return res;
+}
+
+/* Pool of worker threads, one per given CPU, thread i being pinned to
+ * cpus[i] (Linux only) so that the pages first touched by a given thread
+ * stay local to the NUMA node it keeps running on; failures to pin are
+ * reported to std::cerr and the thread left unpinned. run(f) releases the
+ * workers to execute f(0),...,f(size()-1) and waits for them to finish;
+ * workers spin (yielding) between runs, so that the cost of a run is not
+ * that of thread creation or wakeup.
+ */
+
+class pinned_workers
+{
+public:
+  explicit pinned_workers(const std::vector<int>& cpus)
+  {
+    threads.reserve(cpus.size());
+    for(unsigned int i=0;i<cpus.size();++i){
+      threads.emplace_back([this,i](){work(i);});
+
+      /* workers touch no memory before the first run */
+      cpu_set_t cpu;
+      CPU_ZERO(&cpu);
+      CPU_SET(cpus[i],&cpu);
+      int err=pthread_setaffinity_np(
+        threads.back().native_handle(),sizeof(cpu_set_t),&cpu);
+      if(err!=0){
+        std::cerr<<"can't pin worker "<<i<<" to CPU "<<cpus[i]<<": "
+                 <<std::strerror(err)<<std::endl;
+      }
+    }
+  }
+
+  pinned_workers(const pinned_workers&)=delete;
+  pinned_workers& operator=(const pinned_workers&)=delete;
+
+  ~pinned_workers()
+  {
+    job=nullptr;
+    release();
+    for(auto& t:threads)t.join();
+  }
+
+  unsigned int size()const{return static_cast<unsigned int>(threads.size());}
+
+  template<typename F>
+  void run(F f)
+  {
+    job=[&f](unsigned int i){f(i);};
+    release();
+    while(pending.load(std::memory_order_acquire))std::this_thread::yield();
+  }
+
+private:
+  void release()
+  {
+    pending.store(size(),std::memory_order_relaxed);
+    generation.fetch_add(1,std::memory_order_release);
+  }
+
+  void work(unsigned int i)
+  {
+    for(unsigned int seen=0;;){
+      unsigned int g;
+      while((g=generation.load(std::memory_order_acquire))==seen){
+        std::this_thread::yield();
+      }
+      seen=g;
+      if(!job)return;
+      job(i);
+      pending.fetch_sub(1,std::memory_order_release);
+    }
+  }
+
+  std::vector<std::thread>               threads;
+  std::function<void(unsigned int)>      job;
+  std::atomic<unsigned int>              generation{0},pending{0};
+};
+
+/* Partition of an m x m matrix into num_threads rectangular blocks, either
+ * bands of consecutive rows or a grid of tiles as close to square as
+ * num_threads allows.
+ */
+
+struct matrix_block
+{
+  std::size_t i0,i1,j0,j1;
+};
+
+matrix_block row_block(std::size_t m,unsigned int num_threads,unsigned int t)
+{
+  return {m*t/num_threads,m*(t+1)/num_threads,0,m};
+}
+
+matrix_block tile_block(
+  std::size_t m,unsigned int num_threads,unsigned int t)
+{
+  unsigned int pc=static_cast<unsigned int>(std::sqrt(num_threads));
+  while(num_threads%pc)--pc;
+  unsigned int pr=num_threads/pc,r=t/pc,c=t%pc;
+  return {m*r/pr,m*(r+1)/pr,m*c/pc,m*(c+1)/pc};
+}
+
+template<typename Matrix>
+void fill_block(Matrix& a,const matrix_block& b)
+{
+  for(std::size_t i=b.i0;i<b.i1;++i){
+    for(std::size_t j=b.j0;j<b.j1;++j){
+      a[i][j]=i+j;
+    }
+  }
+}
+
+template<typename Matrix>
+long int sum_block(const Matrix& a,const matrix_block& b)
+{
+  long int res=0;
+  for(std::size_t i=b.i0;i<b.i1;++i){
+    for(std::size_t j=b.j0;j<b.j1;++j){
+      res+=a[i][j];
+    }
+  }
+  return res;
+}
+
+/* Parallel reduction of a over the given block partition, with one
+ * worker per given CPU. With a local fill, each block is first touched by
+ * the same thread that later reduces it, so memory is local to that
+ * thread; a remote fill has block t filled by worker
+ * (t+num_threads/2)%num_threads, half the pool away from the reducing one
+ * and so, workers being pinned in CPU order, typically on another socket;
+ * a serial fill reproduces the usual pattern of one thread filling the
+ * matrix and many scanning it, with all pages on the filler's node. The
+ * matrix is a fresh mmapped region, unmapped afterwards: memory recycled
+ * from the heap would already have been placed by whoever touched it
+ * before.
+ */
+
+enum class fill_policy{local,remote,serial};
+
+struct small_pages_deleter
+{
+  void operator()(int* p)const
+  {
+    page_allocator<int,page_policy::small_pages>().deallocate(p,n);
+  }
+
+  std::size_t n;
+};
+
+template<typename Partition>
+void measure_parallel(
+  const std::vector<int>& cpus,std::size_t m,Partition partition,
+  fill_policy fill,const char* terminator)
+{
+  pinned_workers workers(cpus);
+  unsigned int   num_threads=workers.size();
+  std::unique_ptr<int[],small_pages_deleter> buf(
+    page_allocator<int,page_policy::small_pages>().allocate(m*m),
+    small_pages_deleter{m*m});
+  boost::multi_array_ref<int,2> a(buf.get(),boost::extents[m][m]);
+
+  switch(fill){
+    case fill_policy::local:
+      workers.run([&](unsigned int t){
+        fill_block(a,partition(m,num_threads,t));
+      });
+      break;
+    case fill_policy::remote:
+      workers.run([&](unsigned int w){ /* w=(t+num_threads/2)%num_threads */
+        unsigned int t=(w+num_threads-num_threads/2)%num_threads;
+        fill_block(a,partition(m,num_threads,t));
+      });
+      break;
+    case fill_policy::serial:
+      fill_matrix(a,m);
+      break;
+  }
+
+  std::vector<long int> partial_sums(num_threads);
+  std::cout<<measure(m*m,[&](){
+    workers.run([&](unsigned int t){
+      partial_sums[t]=sum_block(a,partition(m,num_threads,t));
+    });
+    return std::accumulate(partial_sums.begin(),partial_sums.end(),0L);
+  })<<terminator;
+}
+
+/* row_col and col_row columns with the matrix allocated under the given
+ * page policy, "n/a" if the system can't provide such pages.
+ */
+
+template<page_policy Policy>
+void measure_with_pages(std::size_t m,const char* terminator)
+{
+  try{
+    boost::multi_array<int,2,page_allocator<int,Policy>> a(
+      boost::extents[m][m]);
+    fill_matrix(a,m);
+    std::cout<<measure(m*m,[&](){return sum_row_col(a,m);})<<";";
+    std::cout<<measure(m*m,[&](){return sum_col_row(a,m);})<<terminator;
+  }
+  catch(const std::bad_alloc&){
+    std::cout<<"n/a;n/a"<<terminator;
+  }
+}
+
+/* row_col and col_row columns over an int dataset previously written by
+ * dataset_generator: each size step maps the first m*m ints of the file
+ * as an m x m matrix rather than synthesizing it.
+ */
+
+void measure_mapped(
+  const char* path,std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+{
+  mapped_file file(path);
+
+  std::cout<<"matrix sum (mapped dataset):"<<std::endl;
+  std::cout<<"n;row_col;col_row"<<std::endl;
+
+  n1=std::min(n1,file.size()/sizeof(int));
+  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+    std::size_t                         m=
+      static_cast<std::size_t>(std::sqrt(n));
+    boost::const_multi_array_ref<int,2> a(
+      file.data<int>(),boost::extents[m][m]);
+
+    std::cout<<m*m<<";";
+    std::cout<<measure(m*m,[&](){return sum_row_col(a,m);})<<";";
+    std::cout<<measure(m*m,[&](){return sum_col_row(a,m);})<<"\n";
+  }
+}
+
+int main(int argc,char* argv[])
 {
   std::size_t n0=10000,n1=40000000,dn=2000;
   double      fdn=1.1;    
 
+  if(argc==2){
+    try{
+      measure_mapped(argv[1],n0,n1,dn,fdn);
+      return 0;
+    }
+    catch(const std::exception& e){
+      std::cerr<<e.what()<<std::endl;
+      return 1;
+    }
+  }
+  else if(argc!=1){
+    std::cerr<<"usage: "<<argv[0]<<" [int_dataset]"<<std::endl;
+    return 1;
+  }
+
   std::cout<<"matrix sum:"<<std::endl;
-  std::cout<<"n;row_col;col_row"<<std::endl;
+  std::cout<<"n;row_col;col_row;row_col 4K;col_row 4K;"
+             "row_col THP;col_row THP;row_col 2M;col_row 2M;"
+             "row_col 1G;col_row 1G;"
+             "parallel rows;parallel tiles;parallel rows serial fill;"
+             "parallel rows remote fill;setup"
+           <<std::endl;
+
+  /* parallel columns use one worker per allowed CPU, or per CPU
+   * 0,...,hardware_concurrency()-1 if these can't be retrieved
+   */
+  std::vector<int> cpus=allowed_cpus();
+  if(cpus.empty()){
+    std::cerr<<"can't retrieve allowed CPUs"<<std::endl;
+    cpus.resize(std::max(1u,std::thread::hardware_concurrency()));
+    std::iota(cpus.begin(),cpus.end(),0);
+  }
     
   for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
     std::size_t               m=static_cast<std::size_t>(std::sqrt(n));
     boost::multi_array<int,2> a(boost::extents[m][m]);
 
     /* fill with some values */
-    for(std::size_t i=0;i<m;++i){
-      for(std::size_t j=0;j<m;++j){
-        a[i][j]=i+j;
-      }
-    }
+    fill_matrix(a,m);
 
     std::cout<<m*m<<";";
-    std::cout<<measure(m*m,[&](){
-      long int res=0;
-      for(std::size_t i=0;i<m;++i){
-        for(std::size_t j=0;j<m;++j){
-          res+=a[i][j];
-        }
-      }
-      return res;
-    })<<";";
-
-    std::cout<<measure(m*m,[&](){
-      long int res=0;
-      for(std::size_t j=0;j<m;++j){
-        for(std::size_t i=0;i<m;++i){
-          res+=a[i][j];
-        }
-      }
-      return res;
-    })<<"\n";
+    std::cout<<measure(m*m,[&](){return sum_row_col(a,m);})<<";";
+    std::cout<<measure(m*m,[&](){return sum_col_row(a,m);})<<";";
+    measure_with_pages<page_policy::small_pages>(m,";");
+    measure_with_pages<page_policy::transparent_huge_pages>(m,";");
+    measure_with_pages<page_policy::huge_pages_2mb>(m,";");
+    measure_with_pages<page_policy::huge_pages_1gb>(m,";");
+    measure_parallel(cpus,m,row_block,fill_policy::local,";");
+    measure_parallel(cpus,m,tile_block,fill_policy::local,";");
+    measure_parallel(cpus,m,row_block,fill_policy::serial,";");
+    measure_parallel(cpus,m,row_block,fill_policy::remote,";");
+    std::cout<<setup_time()<<"\n";
   }
 }
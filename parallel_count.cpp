@@ -12,6 +12,9 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
         
 template<typename F>
 double measure(F f)
@@ -22,6 +25,7 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
@@ -36,6 +40,7 @@ double measure(F f)
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
   return std::accumulate(
@@ -58,56 +63,259 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <pthread.h>
 #include <random>
+#include <sched.h>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
+/* CPU topology as read from /sys/devices/system/cpu (Linux only): the
+ * logical CPUs available to the process grouped by physical core, and
+ * cores grouped by package (socket). Cores are identified by their list
+ * of hardware threads (core_cpus_list, or thread_siblings_list in older
+ * kernels), as core_id need not be unique within a package.
+ */
+
+using cpu_topology=std::map<
+  int,std::map<std::string,std::vector<int>>>; /* package->core->cpus */
+
+cpu_topology read_cpu_topology()
+{
+  cpu_topology res;
+  cpu_set_t    cpus;
+  if(sched_getaffinity(0,sizeof(cpu_set_t),&cpus)!=0)return res;
+
+  for(int cpu=0;cpu<CPU_SETSIZE;++cpu){
+    if(!CPU_ISSET(cpu,&cpus))continue;
+
+    std::string   dir=
+      "/sys/devices/system/cpu/cpu"+std::to_string(cpu)+"/topology/";
+    std::ifstream package_file(dir+"physical_package_id"),
+                  core_file(dir+"core_cpus_list");
+    if(!core_file)core_file.open(dir+"thread_siblings_list");
+    int           package;
+    std::string   core;
+    if(package_file>>package&&core_file>>core){
+      res[package][core].push_back(cpu);
+    }
+  }
+  return res;
+}
+
+/* Thread placements for the four counting threads, as the CPUs to pin
+ * each of them to:
+ *   - smt: two physical cores, both hardware threads of each,
+ *   - core: four distinct physical cores of the same socket,
+ *   - socket: two distinct physical cores on each of two sockets.
+ * Empty if the machine can't accommodate the placement.
+ */
+
+using placement=std::vector<int>;
+
+placement smt_placement(const cpu_topology& topology)
+{
+  for(const auto& package:topology){
+    placement res;
+    for(const auto& core:package.second){
+      if(core.second.size()<2)continue;
+      res.push_back(core.second[0]);
+      res.push_back(core.second[1]);
+      if(res.size()==4)return res;
+    }
+  }
+  return placement();
+}
+
+placement core_placement(const cpu_topology& topology)
+{
+  for(const auto& package:topology){
+    placement res;
+    for(const auto& core:package.second){
+      res.push_back(core.second[0]);
+      if(res.size()==4)return res;
+    }
+  }
+  return placement();
+}
+
+placement socket_placement(const cpu_topology& topology)
+{
+  placement res;
+  for(const auto& package:topology){
+    if(package.second.size()<2)continue;
+    auto it=package.second.begin();
+    res.push_back(it->second[0]);
+    res.push_back((++it)->second[0]);
+    if(res.size()==4)return res;
+  }
+  return placement();
+}
+
+/* Pool of num_threads worker threads, thread i being pinned to cpus[i]
+ * if cpus is not empty (failures to pin are reported to std::cerr), so
+ * that thread creation and pinning happen before measurement starts.
+ * run(f) releases the workers to execute f(0),...,f(num_threads-1) and
+ * waits for them to finish; workers spin (yielding) between runs.
+ */
+
+class pinned_workers
+{
+public:
+  pinned_workers(unsigned int num_threads,const placement& cpus)
+  {
+    threads.reserve(num_threads);
+    for(unsigned int i=0;i<num_threads;++i){
+      threads.emplace_back([this,i](){work(i);});
+      if(cpus.empty())continue;
+
+      cpu_set_t cpu;
+      CPU_ZERO(&cpu);
+      CPU_SET(cpus[i],&cpu);
+      int err=pthread_setaffinity_np(
+        threads.back().native_handle(),sizeof(cpu_set_t),&cpu);
+      if(err!=0){
+        std::cerr<<"can't pin worker "<<i<<" to CPU "<<cpus[i]<<": "
+                 <<std::strerror(err)<<std::endl;
+      }
+    }
+  }
+
+  pinned_workers(const pinned_workers&)=delete;
+  pinned_workers& operator=(const pinned_workers&)=delete;
+
+  ~pinned_workers()
+  {
+    job=nullptr;
+    release();
+    for(auto& t:threads)t.join();
+  }
+
+  unsigned int size()const{return static_cast<unsigned int>(threads.size());}
+
+  template<typename F>
+  void run(F f)
+  {
+    job=[&f](unsigned int i){f(i);};
+    release();
+    while(pending.load(std::memory_order_acquire))std::this_thread::yield();
+  }
+
+private:
+  void release()
+  {
+    pending.store(size(),std::memory_order_relaxed);
+    generation.fetch_add(1,std::memory_order_release);
+  }
+
+  void work(unsigned int i)
+  {
+    for(unsigned int seen=0;;){
+      unsigned int g;
+      while((g=generation.load(std::memory_order_acquire))==seen){
+        std::this_thread::yield();
+      }
+      seen=g;
+      if(!job)return;
+      job(i);
+      pending.fetch_sub(1,std::memory_order_release);
+    }
+  }
+
+  std::vector<std::thread>               threads;
+  std::function<void(unsigned int)>      job;
+  std::atomic<unsigned int>              generation{0},pending{0};
+};
+
 int main()
 {
   std::size_t n0=10000,n1=40000000,dn=2000;
   double      fdn=1.1;    
 
+  /* near: per-thread counters in the same cache line (false sharing),
+   * far: counters in separate lines, sharing cost: near/far; unpinned,
+   * then for each placement
+   */
   std::cout<<"parallel count:"<<std::endl;
-  std::cout<<"n;near;far"<<std::endl;
-    
-  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
-    std::mt19937                    gen;
-    std::uniform_int_distribution<> rnd(0,255);
-    std::vector<int> v;
-    v.reserve(n);
+  std::cout<<"n;near;far;sharing cost;"
+             "near smt;far smt;sharing cost smt;"
+             "near core;far core;sharing cost core;"
+             "near socket;far socket;sharing cost socket;setup"<<std::endl;
+
+  auto                            topology=read_cpu_topology();
+  std::array<placement,4>         placements={{
+                                    placement(),
+                                    smt_placement(topology),
+                                    core_placement(topology),
+                                    socket_placement(topology)}};
+  std::mt19937                    gen;
+  std::uniform_int_distribution<> rnd(0,255);
+  std::vector<int> v;
+  v.reserve(n1);
     
-    /* fill with some values */
-    for(std::size_t i=0;i<n;++i)v.push_back(rnd(gen));
+  /* fill with some values, once for the largest size: steps work on
+   * prefixes
+   */
+  for(std::size_t i=0;i<n1;++i)v.push_back(rnd(gen));
     
+  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
     int res[49];
 
-    auto f=[&](int* px,int* py,int* pz,int* pw){
-      auto th=[](int* p,int* first,int* last){
+    auto f=[&](pinned_workers& workers,int* px,int* py,int* pz,int* pw){
+      int* counters[]={px,py,pz,pw};
+      workers.run([&](unsigned int i){
+        int* p=counters[i];
+        int* first=v.data()+n*i/4;
+        int* last=v.data()+n*(i+1)/4;
         *p=0;
         while(first!=last){
           int x=*first++;
           *p+=x%2;
         }
-      };
-
-      std::thread t1(th,px,v.data(),v.data()+n/4);
-      std::thread t2(th,py,v.data()+n/4,v.data()+n/2);
-      std::thread t3(th,pz,v.data()+n/2,v.data()+n*3/4);
-      std::thread t4(th,pw,v.data()+n*3/4,v.data()+n);
-      t1.join();
-      t2.join();
-      t3.join();
-      t4.join();
+      });
       return *px+*py+*pz+*pw;
     };
 
     std::cout<<n<<";";
-    std::cout<<measure(n,[&](){
-      return f(&res[0],&res[1],&res[2],&res[3]);
-    })<<";";
-    std::cout<<measure(n,[&](){
-      return f(&res[0],&res[16],&res[32],&res[48]);
-    })<<"\n";
+    for(std::size_t i=0;i<placements.size();++i){
+      const auto& cpus=placements[i];
+      if(i&&cpus.empty()){
+        std::cout<<"n/a;n/a;n/a;";
+        continue;
+      }
+      pinned_workers workers(4,cpus);
+      double         near=measure(n,[&](){
+        return f(workers,&res[0],&res[1],&res[2],&res[3]);
+      });
+      double         far=measure(n,[&](){
+        return f(workers,&res[0],&res[16],&res[32],&res[48]);
+      });
+      std::cout<<near<<";"<<far<<";"<<near/far<<";";
+    }
+    std::cout<<setup_time()<<"\n";
   }
 }
@@ -0,0 +1,286 @@
+/* usingstdcpp2015: particle update step, AOS vs SOA, with streaming stores.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+ 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric> 
+    
+std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
+        
+template<typename F>
+double measure(F f)
+{
+  using namespace std::chrono;
+        
+  static const int              num_trials=10;
+  static const milliseconds     min_time_per_trial(200);
+  std::array<double,num_trials> trials;
+  volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
+        
+  for(int i=0;i<num_trials;++i){
+    int                               runs=0;
+    high_resolution_clock::time_point t2;
+        
+    measure_start=high_resolution_clock::now();
+    do{
+      res=f();
+      ++runs;
+      t2=high_resolution_clock::now();
+    }while(t2-measure_start<min_time_per_trial);
+    trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+  }
+  (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
+        
+  std::sort(trials.begin(),trials.end());
+  return std::accumulate(
+    trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+}
+ 
+template<typename Size,typename F>
+double measure(Size n,F f)
+{
+  return measure(f)/n;
+}
+
+void pause_timing()
+{
+  measure_pause=std::chrono::high_resolution_clock::now();
+}
+        
+void resume_timing()
+{
+  measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
+}
+
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+struct particle
+{
+  int x,y,z;
+  int dx,dy,dz;
+};
+
+using particle_aos=std::vector<particle>;
+
+particle_aos create_particle_aos(int n)
+{
+  particle_aos res;
+  res.reserve(n);
+  for(int i=0;i<n;++i)res.push_back({i,i+1,i+2,i%7-3,i%5-2,i%3-1});
+  return res;
+}
+
+struct particle_soa
+{
+  std::vector<int> x,y,z;
+  std::vector<int> dx,dy,dz;
+};
+
+particle_soa create_particle_soa(int n)
+{
+  particle_soa res;
+  res.x.reserve(n);
+  res.y.reserve(n);
+  res.z.reserve(n);
+  res.dx.reserve(n);
+  res.dy.reserve(n);
+  res.dz.reserve(n);
+  for(int i=0;i<n;++i){
+    res.x.push_back(i);
+    res.y.push_back(i+1);
+    res.z.push_back(i+2);
+    res.dx.push_back(i%7-3);
+    res.dy.push_back(i%5-2);
+    res.dz.push_back(i%3-1);
+  }
+  return res;
+}
+
+/* In-place updates alternate between moving particles forwards and
+ * backwards so that positions stay bounded however many times the kernel
+ * runs.
+ */
+
+int update_aos(particle_aos& ps,std::size_t n,int sign)
+{
+  for(std::size_t i=0;i<n;++i){
+    ps[i].x+=sign*ps[i].dx;
+    ps[i].y+=sign*ps[i].dy;
+    ps[i].z+=sign*ps[i].dz;
+  }
+  return ps[0].x;
+}
+
+int update_soa(particle_soa& ps,std::size_t n,int sign)
+{
+  for(std::size_t i=0;i<n;++i){
+    ps.x[i]+=sign*ps.dx[i];
+    ps.y[i]+=sign*ps.dy[i];
+    ps.z[i]+=sign*ps.dz[i];
+  }
+  return ps.x[0];
+}
+
+/* Out-of-place updates write into a separate output: whole records for
+ * AOS, only the position columns for SOA.
+ */
+
+int update_aos(const particle_aos& ps,particle_aos& out,std::size_t n)
+{
+  for(std::size_t i=0;i<n;++i){
+    out[i]={
+      ps[i].x+ps[i].dx,ps[i].y+ps[i].dy,ps[i].z+ps[i].dz,
+      ps[i].dx,ps[i].dy,ps[i].dz};
+  }
+  return out[0].x;
+}
+
+void update_column(const int* x,const int* dx,int* out,std::size_t n)
+{
+  for(std::size_t i=0;i<n;++i)out[i]=x[i]+dx[i];
+}
+
+int update_soa(const particle_soa& ps,particle_soa& out,std::size_t n)
+{
+  update_column(ps.x.data(),ps.dx.data(),out.x.data(),n);
+  update_column(ps.y.data(),ps.dy.data(),out.y.data(),n);
+  update_column(ps.z.data(),ps.dz.data(),out.z.data(),n);
+  return out.x[0];
+}
+
+#if defined(__SSE2__)
+/* Same out-of-place updates with non-temporal stores, which write around
+ * the cache and so avoid reading each output line in before overwriting
+ * it (write-allocate). AOS records are stored an int at a time (movnti);
+ * SOA columns use the widest vector stores available, after a scalar
+ * prologue reaching the required alignment.
+ */
+
+int update_aos_streaming(
+  const particle_aos& ps,particle_aos& out,std::size_t n)
+{
+  for(std::size_t i=0;i<n;++i){
+    int* p=&out[i].x;
+    _mm_stream_si32(p,  ps[i].x+ps[i].dx);
+    _mm_stream_si32(p+1,ps[i].y+ps[i].dy);
+    _mm_stream_si32(p+2,ps[i].z+ps[i].dz);
+    _mm_stream_si32(p+3,ps[i].dx);
+    _mm_stream_si32(p+4,ps[i].dy);
+    _mm_stream_si32(p+5,ps[i].dz);
+  }
+  _mm_sfence();
+  return out[0].x;
+}
+
+void update_column_streaming(
+  const int* x,const int* dx,int* out,std::size_t n)
+{
+#if defined(__AVX2__)
+  static const std::size_t alignment=32;
+#else
+  static const std::size_t alignment=16;
+#endif
+
+  std::size_t i=0;
+  for(;i<n&&reinterpret_cast<std::uintptr_t>(out+i)%alignment;++i){
+    out[i]=x[i]+dx[i];
+  }
+#if defined(__AVX2__)
+  for(;i+8<=n;i+=8){
+    __m256i v=_mm256_add_epi32(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x+i)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dx+i)));
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(out+i),v);
+  }
+#else
+  for(;i+4<=n;i+=4){
+    __m128i v=_mm_add_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(x+i)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(dx+i)));
+    _mm_stream_si128(reinterpret_cast<__m128i*>(out+i),v);
+  }
+#endif
+  for(;i<n;++i)out[i]=x[i]+dx[i];
+}
+
+int update_soa_streaming(
+  const particle_soa& ps,particle_soa& out,std::size_t n)
+{
+  update_column_streaming(ps.x.data(),ps.dx.data(),out.x.data(),n);
+  update_column_streaming(ps.y.data(),ps.dy.data(),out.y.data(),n);
+  update_column_streaming(ps.z.data(),ps.dz.data(),out.z.data(),n);
+  _mm_sfence();
+  return out.x[0];
+}
+#endif
+
+int main()
+{
+  std::size_t n0=10000,n1=40000000,dn=2000;
+  double      fdn=1.1;    
+
+  std::cout<<"particle update:"<<std::endl;
+  std::cout<<"n;aos in-place;soa in-place;aos out-of-place;soa out-of-place;"
+             "aos streaming;soa streaming;setup"<<std::endl;
+
+  /* data generated once for the largest size, steps work on prefixes */
+  auto aos=create_particle_aos(n1),aos_out=aos;
+  auto soa=create_particle_soa(n1),soa_out=soa;
+  int  sign=1;
+    
+  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+    std::cout<<n<<";";
+    std::cout<<measure(n,[&](){
+      return update_aos(aos,n,sign=-sign);
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return update_soa(soa,n,sign=-sign);
+    })<<";";
+    std::cout<<measure(n,[&](){return update_aos(aos,aos_out,n);})<<";";
+    std::cout<<measure(n,[&](){return update_soa(soa,soa_out,n);})<<";";
+#if defined(__SSE2__)
+    std::cout<<measure(n,[&](){
+      return update_aos_streaming(aos,aos_out,n);
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return update_soa_streaming(soa,soa_out,n);
+    })<<";";
+#else
+    std::cout<<"n/a;n/a;";
+#endif
+    std::cout<<setup_time()<<"\n";
+  }
+}
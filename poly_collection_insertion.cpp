@@ -0,0 +1,419 @@
+/* usingstdcpp2015: concurrent insertion into a polymorphic collection.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+ 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric> 
+    
+std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+        
+template<typename F>
+double measure(F f)
+{
+  using namespace std::chrono;
+        
+  static const int              num_trials=10;
+  static const milliseconds     min_time_per_trial(200);
+  std::array<double,num_trials> trials;
+  volatile decltype(f())        res; /* to avoid optimizing f() away */
+        
+  for(int i=0;i<num_trials;++i){
+    int                               runs=0;
+    high_resolution_clock::time_point t2;
+        
+    measure_start=high_resolution_clock::now();
+    do{
+      res=f();
+      ++runs;
+      t2=high_resolution_clock::now();
+    }while(t2-measure_start<min_time_per_trial);
+    trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+  }
+  (void)(res); /* var not used warn */
+        
+  std::sort(trials.begin(),trials.end());
+  return std::accumulate(
+    trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+}
+ 
+template<typename Size,typename F>
+double measure(Size n,F f)
+{
+  return measure(f)/n;
+}
+
+void pause_timing()
+{
+  measure_pause=std::chrono::high_resolution_clock::now();
+}
+        
+void resume_timing()
+{
+  measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
+}
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <typeindex>
+#include <type_traits>
+#include <vector>
+
+/* poly_collection as in poly_containers.cpp, extended with size(),
+ * reserve(n), which also applies to segments created afterwards, and
+ * splice(x), which moves all the elements of x to the end of the
+ * corresponding segments in bulk, leaving x empty but with its segments
+ * and their capacity in place for reuse.
+ */
+
+template<class Base>
+class poly_collection_segment_base
+{
+public:
+  virtual ~poly_collection_segment_base(){};
+
+  void insert(const Base& x)
+  {
+    this->insert_(x);
+  }
+
+  /* x must be a segment of the same type */
+  void splice(poly_collection_segment_base& x)
+  {
+    this->splice_(x);
+  }
+
+  std::size_t size()const
+  {
+    return this->size_();
+  }
+
+  void reserve(std::size_t n)
+  {
+    this->reserve_(n);
+  }
+
+  /* an empty segment of the same type */
+  poly_collection_segment_base* make_empty()const
+  {
+    return this->make_empty_();
+  }
+
+  template<typename F>
+  void for_each(F& f)
+  {
+    std::size_t s=this->element_size_();
+    for(auto it=this->begin_(),end=it+this->size_()*s;it!=end;it+=s){
+      f(*reinterpret_cast<Base*>(it));
+    }
+  }
+  
+  template<typename F>
+  void for_each(F& f)const
+  {
+    std::size_t s=this->element_size_();
+    for(auto it=this->begin_(),end=it+this->size_()*s;it!=end;it+=s){
+      f(*reinterpret_cast<const Base*>(it));
+    }
+  }
+
+private:  
+  virtual void insert_(const Base& x)=0;
+  virtual void splice_(poly_collection_segment_base& x)=0;
+  virtual void reserve_(std::size_t n)=0;
+  virtual poly_collection_segment_base* make_empty_()const=0;
+  virtual char* begin_()=0;
+  virtual const char* begin_()const=0;
+  virtual std::size_t size_()const=0;
+  virtual std::size_t element_size_()const=0;
+};
+
+template<class Derived,class Base>
+class poly_collection_segment:
+  public poly_collection_segment_base<Base>
+{
+private:
+  virtual void insert_(const Base& x)
+  {
+    store.push_back(static_cast<const Derived&>(x));
+  }
+
+  virtual void splice_(poly_collection_segment_base<Base>& x)
+  {
+    auto& xstore=static_cast<poly_collection_segment&>(x).store;
+    store.insert(
+      store.end(),
+      std::make_move_iterator(xstore.begin()),
+      std::make_move_iterator(xstore.end()));
+    xstore.clear();
+  }
+
+  virtual void reserve_(std::size_t n)
+  {
+    store.reserve(n);
+  }
+
+  virtual poly_collection_segment_base<Base>* make_empty_()const
+  {
+    return new poly_collection_segment();
+  }
+
+  virtual char* begin_()
+  {
+    return reinterpret_cast<char*>(
+      static_cast<Base*>(const_cast<Derived*>(store.data())));
+  }
+
+  virtual const char* begin_()const
+  {
+    return reinterpret_cast<const char*>(
+      static_cast<const Base*>(store.data()));
+  }
+
+  virtual std::size_t size_()const{return store.size();}
+  virtual std::size_t element_size_()const{return sizeof(Derived);}
+
+  std::vector<Derived> store;
+};
+
+template<class Base>
+class poly_collection
+{
+public:
+  template<class Derived>
+  void insert(
+    const Derived& x,
+    typename std::enable_if<std::is_base_of<Base,Derived>::value>::type* =0)
+  {
+    auto& pchunk=chunks[typeid(x)];
+    if(!pchunk){
+      pchunk.reset(new poly_collection_segment<Derived,Base>());
+      pchunk->reserve(reserved);
+    }
+    pchunk->insert(x);
+  }
+
+  void reserve(std::size_t n)
+  {
+    reserved=n;
+    for(const auto& p:chunks)p.second->reserve(n);
+  }
+
+  void splice(poly_collection& x)
+  {
+    for(const auto& p:x.chunks){
+      auto& pchunk=chunks[p.first];
+      if(!pchunk)pchunk.reset(p.second->make_empty());
+      pchunk->splice(*p.second);
+    }
+  }
+
+  std::size_t size()const
+  {
+    std::size_t res=0;
+    for(const auto& p:chunks)res+=p.second->size();
+    return res;
+  }
+ 
+  template<typename F>
+  F for_each(F f)
+  {
+    for(const auto& p:chunks)p.second->for_each(f);
+    return std::move(f);
+  }
+
+  template<typename F>
+  F for_each(F f)const
+  {
+    for(const auto& p:chunks)
+      const_cast<const segment&>(*p.second).for_each(f);
+    return std::move(f);
+  }
+
+private:
+  typedef poly_collection_segment_base<Base> segment;
+  typedef std::unique_ptr<segment>           pointer;
+
+  std::map<std::type_index,pointer> chunks;
+  std::size_t                       reserved=0;
+};
+
+/* Concurrent insertion mode: each producer thread owns a
+ * poly_collection_inserter, which stages elements into a private
+ * poly_collection (so, a buffer per type, reserved to batch_size and
+ * reused across batches) and splices it into the shared collection under
+ * the mutex every batch_size insertions and on destruction. The shared
+ * collection must not be otherwise accessed while inserters are alive.
+ */
+
+template<class Base>
+class poly_collection_inserter
+{
+public:
+  poly_collection_inserter(
+    poly_collection<Base>& pc,std::mutex& mtx,std::size_t batch_size=4096):
+    pc(pc),mtx(mtx),batch_size(batch_size)
+  {
+    staging.reserve(batch_size);
+  }
+
+  poly_collection_inserter(const poly_collection_inserter&)=delete;
+  poly_collection_inserter& operator=(const poly_collection_inserter&)=delete;
+
+  ~poly_collection_inserter(){flush();}
+
+  template<class Derived>
+  void insert(const Derived& x)
+  {
+    staging.insert(x);
+    if(++staged==batch_size)flush();
+  }
+
+  void flush()
+  {
+    if(!staged)return;
+    std::lock_guard<std::mutex> lock(mtx);
+    pc.splice(staging);
+    staged=0;
+  }
+
+private:
+  poly_collection<Base>& pc;
+  std::mutex&            mtx;
+  std::size_t            batch_size;
+  poly_collection<Base>  staging;
+  std::size_t            staged=0;
+};
+
+struct base
+{
+  virtual int f()const=0;
+  virtual ~base(){}
+};
+
+struct derived1:base
+{
+  virtual int f()const{return 1;};  
+};
+
+struct derived2:base
+{
+  virtual int f()const{return 2;};  
+};
+
+struct derived3:base
+{
+  virtual int f()const{return 3;};  
+};
+
+template<typename Inserter>
+void insert_types(
+  Inserter& inserter,
+  std::vector<int>::const_iterator first,std::vector<int>::const_iterator last)
+{
+  for(;first!=last;++first){
+    switch(*first){
+      case 0: inserter.insert(derived1());break;
+      case 1: inserter.insert(derived2());break;
+      case 2: 
+      default:inserter.insert(derived3());break;
+    }
+  }
+}
+
+/* Inserts objects of the given types into a fresh collection from
+ * num_producers threads, each taking a contiguous slice of types; the
+ * collection is destroyed with timing paused.
+ */
+
+template<typename Producer>
+std::size_t insert_concurrently(
+  const std::vector<int>& types,std::size_t num_producers,Producer producer)
+{
+  auto                     pc=std::make_unique<poly_collection<base>>();
+  std::mutex               mtx;
+  std::vector<std::thread> threads;
+  std::size_t              n=types.size();
+
+  for(std::size_t i=0;i<num_producers;++i){
+    threads.emplace_back(
+      producer,std::ref(*pc),std::ref(mtx),
+      types.begin()+n*i/num_producers,types.begin()+n*(i+1)/num_producers);
+  }
+  for(auto& t:threads)t.join();
+
+  std::size_t res=pc->size();
+  pause_timing();
+  pc.reset();
+  resume_timing();
+  return res;
+}
+
+/* global lock: every insertion locks the shared collection */
+
+struct locked_inserter
+{
+  template<class Derived>
+  void insert(const Derived& x)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    pc.insert(x);
+  }
+
+  poly_collection<base>& pc;
+  std::mutex&            mtx;
+};
+
+void global_lock_producer(
+  poly_collection<base>& pc,std::mutex& mtx,
+  std::vector<int>::const_iterator first,std::vector<int>::const_iterator last)
+{
+  locked_inserter inserter{pc,mtx};
+  insert_types(inserter,first,last);
+}
+
+void staged_producer(
+  poly_collection<base>& pc,std::mutex& mtx,
+  std::vector<int>::const_iterator first,std::vector<int>::const_iterator last)
+{
+  poly_collection_inserter<base> inserter(pc,mtx);
+  insert_types(inserter,first,last);
+}
+
+int main()
+{
+  std::size_t n=10000000;
+  std::size_t max_producers=std::max(std::thread::hardware_concurrency(),1u);
+
+  std::cout<<"poly_collection insertion ("<<n<<" elements):"<<std::endl;
+  std::cout<<"producers;global lock;staged"<<std::endl;
+
+  std::vector<int> types;
+  {
+    std::mt19937                    gen;
+    std::uniform_int_distribution<> rnd(0,2);
+    types.reserve(n);
+    for(std::size_t i=0;i<n;++i)types.push_back(rnd(gen));
+  }
+
+  for(std::size_t p=1;p<=max_producers;++p){
+    std::cout<<p<<";";
+    std::cout<<measure(n,[&](){
+      return insert_concurrently(types,p,global_lock_producer);
+    })<<";";
+    std::cout<<measure(n,[&](){
+      return insert_concurrently(types,p,staged_producer);
+    })<<"\n";
+  }
+}
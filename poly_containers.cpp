@@ -12,9 +12,248 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
+
+/* Compiling with MEASURE_LATENCY defined makes measure() also time each
+ * invocation of f individually (with rdtsc where available) into a
+ * log-bucketed histogram, and return its p50, p99, p99.9 and max next to
+ * the usual trimmed mean; each column then prints as mean;p50;p99;p99.9;max.
+ */
+
+#if defined(MEASURE_LATENCY)
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#if defined(__x86_64__)||defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+inline std::uint64_t cycle_count()
+{
+#if defined(__x86_64__)||defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+double cycles_per_second()
+{
+  using namespace std::chrono;
+
+  static const double res=[]{
+    steady_clock::time_point t0=steady_clock::now();
+    std::uint64_t            c0=cycle_count();
+    while(steady_clock::now()-t0<milliseconds(100));
+    std::uint64_t            c1=cycle_count();
+    return (c1-c0)/duration_cast<duration<double>>(
+      steady_clock::now()-t0).count();
+  }();
+  return res;
+}
+
+/* HDR-style histogram: values below 2^sub_bucket_bits are recorded
+ * exactly, larger ones with a relative precision of 2^-sub_bucket_bits.
+ */
+
+class latency_histogram
+{
+public:
+  latency_histogram():counts((64-sub_bucket_bits+1)<<sub_bucket_bits){}
+
+  void add(std::uint64_t x)
+  {
+    ++counts[bucket(x)];
+    ++total;
+    if(x>max_)max_=x;
+  }
+
+  std::uint64_t percentile(double q)const
+  {
+    std::uint64_t threshold=static_cast<std::uint64_t>(q*total),acc=0;
+    for(std::size_t i=0;i<counts.size();++i){
+      acc+=counts[i];
+      if(acc>threshold)return std::min(value(i),max_);
+    }
+    return max_;
+  }
+
+  std::uint64_t max()const{return max_;}
+
+private:
+  static const int sub_bucket_bits=7;
+
+  static std::size_t bucket(std::uint64_t x)
+  {
+    if(x<(std::uint64_t(1)<<sub_bucket_bits))return x;
+    int shift=63-__builtin_clzll(x)-sub_bucket_bits;
+    return (std::size_t(shift+1)<<sub_bucket_bits)+
+      ((x>>shift)-(std::uint64_t(1)<<sub_bucket_bits));
+  }
+
+  static std::uint64_t value(std::size_t i)
+  {
+    if(i<(std::size_t(1)<<sub_bucket_bits))return i;
+    int shift=static_cast<int>(i>>sub_bucket_bits)-1;
+    std::uint64_t mantissa=
+      (i&((std::size_t(1)<<sub_bucket_bits)-1))+
+      (std::uint64_t(1)<<sub_bucket_bits);
+    return ((mantissa+1)<<shift)-1; /* upper bound of the bucket */
+  }
+
+  std::vector<std::uint64_t> counts;
+  std::uint64_t              total=0,max_=0;
+};
+
+struct measure_result
+{
+  double mean,p50,p99,p999,max;
+};
+
+measure_result operator/(const measure_result& x,double n)
+{
+  return {x.mean/n,x.p50/n,x.p99/n,x.p999/n,x.max/n};
+}
+
+std::ostream& operator<<(std::ostream& os,const measure_result& x)
+{
+  return os<<x.mean<<";"<<x.p50<<";"<<x.p99<<";"<<x.p999<<";"<<x.max;
+}
+
+const char* not_measured="n/a;n/a;n/a;n/a;n/a";
+const char* const measure_fields[]={" mean"," p50"," p99"," p99.9"," max"};
+#endif
+
+/* Compiling with MEASURE_ENERGY defined makes measure() also read the RAPL
+ * package and DRAM energy counters exposed by Linux under
+ * /sys/class/powercap/intel-rapl around each trial, and return the energy
+ * per invocation (in nJ, trimmed mean) next to the usual time; each column
+ * then prints as time;energy. Energy is whole-system (all packages, idle
+ * and other processes included) and prints as n/a if the counters are not
+ * present or not readable (energy_uj is usually root-only).
+ */
+
+#if defined(MEASURE_ENERGY)
+#if defined(MEASURE_LATENCY)
+#error MEASURE_LATENCY and MEASURE_ENERGY are mutually exclusive
+#endif
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class rapl_counters
+{
+public:
+  rapl_counters()
+  {
+    static const std::string root="/sys/class/powercap/intel-rapl:";
+
+    for(int p=0;;++p){
+      std::string package=root+std::to_string(p);
+      if(!add_zone(package))break;
+      for(int q=0;;++q){
+        if(!add_zone(package+"/intel-rapl:"+std::to_string(p)+":"+
+                     std::to_string(q)))break;
+      }
+    }
+  }
+
+  bool available()const{return !zones.empty();}
+
+  std::vector<std::uint64_t> sample()const
+  {
+    std::vector<std::uint64_t> res;
+    for(const auto& z:zones){
+      std::ifstream is(z.path+"/energy_uj");
+      std::uint64_t e=0;
+      is>>e;
+      res.push_back(e);
+    }
+    return res;
+  }
+
+  double joules(
+    const std::vector<std::uint64_t>& s0,
+    const std::vector<std::uint64_t>& s1)const
+  {
+    double res=0;
+    for(std::size_t i=0;i<zones.size();++i){
+      res+=s1[i]>=s0[i]?
+        s1[i]-s0[i]:
+        zones[i].max_range-s0[i]+s1[i]; /* counter wrapped around */
+    }
+    return res/1E6;
+  }
+
+private:
+  struct zone
+  {
+    std::string   path;
+    std::uint64_t max_range;
+  };
+
+  /* returns false if the zone does not exist */
+  bool add_zone(const std::string& path)
+  {
+    std::ifstream name_file(path+"/name");
+    std::string   name;
+    if(!(name_file>>name))return false;
+    if(name.compare(0,7,"package")!=0&&name!="dram")return true;
+
+    std::ifstream energy_file(path+"/energy_uj"),
+                  range_file(path+"/max_energy_range_uj");
+    std::uint64_t energy,max_range;
+    if(energy_file>>energy&&range_file>>max_range){
+      zones.push_back({path,max_range});
+    }
+    return true;
+  }
+
+  std::vector<zone> zones;
+};
+
+const rapl_counters& rapl()
+{
+  static const rapl_counters res;
+  return res;
+}
+
+struct measure_result
+{
+  double mean,energy;
+};
+
+measure_result operator/(const measure_result& x,double n)
+{
+  return {x.mean/n,x.energy/n};
+}
+
+std::ostream& operator<<(std::ostream& os,const measure_result& x)
+{
+  os<<x.mean<<";";
+  if(std::isnan(x.energy))return os<<"n/a";
+  else                    return os<<x.energy;
+}
+
+const char* not_measured="n/a;n/a";
+const char* const measure_fields[]={" time"," nJ"};
+#endif
+
+#if !defined(MEASURE_LATENCY)&&!defined(MEASURE_ENERGY)
+typedef double measure_result;
+
+const char* not_measured="n/a";
+const char* const measure_fields[]={""};
+#endif
         
 template<typename F>
-double measure(F f)
+measure_result measure(F f)
 {
   using namespace std::chrono;
         
@@ -22,28 +261,68 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
+#if defined(MEASURE_LATENCY)
+  latency_histogram             histogram;
+#endif
+#if defined(MEASURE_ENERGY)
+  std::array<double,num_trials> energies;
+#endif
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
     high_resolution_clock::time_point t2;
         
+#if defined(MEASURE_ENERGY)
+    std::vector<std::uint64_t> e0=rapl().sample();
+#endif
     measure_start=high_resolution_clock::now();
     do{
+#if defined(MEASURE_LATENCY)
+      std::uint64_t c0=cycle_count();
+      res=f();
+      histogram.add(cycle_count()-c0);
+#else
       res=f();
+#endif
       ++runs;
       t2=high_resolution_clock::now();
     }while(t2-measure_start<min_time_per_trial);
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+#if defined(MEASURE_ENERGY)
+    energies[i]=rapl().joules(e0,rapl().sample())/runs;
+#endif
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
-  return std::accumulate(
+  double mean=std::accumulate(
     trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+#if defined(MEASURE_LATENCY)
+  double us_per_cycle=1E6/cycles_per_second();
+  return {
+    mean,
+    histogram.percentile(0.5)*us_per_cycle,
+    histogram.percentile(0.99)*us_per_cycle,
+    histogram.percentile(0.999)*us_per_cycle,
+    histogram.max()*us_per_cycle
+  };
+#elif defined(MEASURE_ENERGY)
+  double energy=std::numeric_limits<double>::quiet_NaN();
+  if(rapl().available()){
+    std::sort(energies.begin(),energies.end());
+    energy=std::accumulate(
+      energies.begin()+2,energies.end()-2,0.0)/(energies.size()-4)*1E9;
+  }
+  return {mean,energy};
+#else
+  return mean;
+#endif
 }
  
 template<typename Size,typename F>
-double measure(Size n,F f)
+measure_result measure(Size n,F f)
 {
   return measure(f)/n;
 }
@@ -58,14 +337,35 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <new>
 #include <random>
+#include <sstream>
+#include <string>
 #include <typeindex>
 #include <type_traits>
+#include <variant>
 #include <vector>
 
 template<class Base>
@@ -169,25 +469,276 @@ private:
   std::map<std::type_index,pointer> chunks;
 };
 
+/* Monotonic arena: memory is bump-allocated from large contiguous blocks
+ * and only given back when the arena is destroyed, so objects allocated
+ * in sequence lie next to each other.
+ */
+
+class monotonic_arena
+{
+public:
+  explicit monotonic_arena(std::size_t block_size=1<<20):
+    block_size(block_size){}
+  monotonic_arena(const monotonic_arena&)=delete;
+  monotonic_arena& operator=(const monotonic_arena&)=delete;
+
+  ~monotonic_arena()
+  {
+    for(auto p:blocks)::operator delete(p);
+  }
+
+  void* allocate(std::size_t size,std::size_t align)
+  {
+    std::size_t pad=(align-reinterpret_cast<std::uintptr_t>(first)%align)%align;
+    if(!first||static_cast<std::size_t>(last-first)<pad+size){
+      std::size_t bs=std::max(block_size,size+align);
+      first=static_cast<char*>(::operator new(bs));
+      last=first+bs;
+      blocks.push_back(first);
+      pad=(align-reinterpret_cast<std::uintptr_t>(first)%align)%align;
+    }
+    void* p=first+pad;
+    first+=pad+size;
+    return p;
+  }
+
+  void deallocate(void*,std::size_t){}
+
+private:
+  std::size_t        block_size;
+  std::vector<void*> blocks;
+  char*              first=nullptr;
+  char*              last=nullptr;
+};
+
+template<typename T>
+class arena_allocator
+{
+public:
+  using value_type=T;
+
+  explicit arena_allocator(monotonic_arena& arena):arena(&arena){}
+  template<typename U>
+  arena_allocator(const arena_allocator<U>& x):arena(x.arena){}
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(arena->allocate(n*sizeof(T),alignof(T)));
+  }
+
+  void deallocate(T* p,std::size_t n)
+  {
+    arena->deallocate(p,n*sizeof(T));
+  }
+
+  template<typename U>
+  friend bool operator==(const arena_allocator& x,const arena_allocator<U>& y)
+    {return x.arena==y.arena;}
+  template<typename U>
+  friend bool operator!=(const arena_allocator& x,const arena_allocator<U>& y)
+    {return x.arena!=y.arena;}
+
+private:
+  template<typename> friend class arena_allocator;
+
+  monotonic_arena* arena;
+};
+
+/* Allocates n blocks of the given size and frees a random half of them,
+ * leaving the global heap riddled with holes that subsequent allocations
+ * of similar size will be served from in no particular order. The
+ * surviving blocks are returned so that the caller decides when the heap
+ * is cleaned up.
+ */
+
+std::vector<std::unique_ptr<char[]>> fragment_heap(
+  std::size_t n,std::size_t size)
+{
+  std::mt19937                         gen(34862);
+  std::vector<std::unique_ptr<char[]>> blocks;
+  blocks.reserve(n);
+  for(std::size_t i=0;i<n;++i)blocks.emplace_back(new char[size]);
+  std::shuffle(blocks.begin(),blocks.end(),gen);
+  blocks.resize(n/2);
+  return blocks;
+}
+
+/* Type-tagged union over a closed set of types Ts...: objects are stored
+ * in place along with the index of their type, so that operations can be
+ * dispatched with a switch on the tag or through a table of function
+ * pointers indexed by it, both resolving to statically bound calls.
+ */
+
+template<typename T,typename... Ts>
+struct type_index_of;
+
+template<typename T,typename... Ts>
+struct type_index_of<T,T,Ts...>:std::integral_constant<std::size_t,0>{};
+
+template<typename T,typename U,typename... Ts>
+struct type_index_of<T,U,Ts...>:
+  std::integral_constant<std::size_t,1+type_index_of<T,Ts...>::value>{};
+
+template<typename... Ts>
+class tagged_object
+{
+public:
+  template<typename T>
+  explicit tagged_object(const T& x):tag_(type_index_of<T,Ts...>::value)
+  {
+    ::new (static_cast<void*>(&storage)) T(x);
+  }
+
+  tagged_object(const tagged_object& x):tag_(x.tag_)
+  {
+    static void (*const copy_table[])(void*,const void*)={&copy<Ts>...};
+    copy_table[tag_](&storage,&x.storage);
+  }
+
+  tagged_object& operator=(const tagged_object& x)
+  {
+    if(this!=&x){
+      this->~tagged_object();
+      ::new (static_cast<void*>(this)) tagged_object(x);
+    }
+    return *this;
+  }
+
+  ~tagged_object()
+  {
+    static void (*const destroy_table[])(void*)={&destroy<Ts>...};
+    destroy_table[tag_](&storage);
+  }
+
+  std::size_t tag()const{return tag_;}
+
+  template<typename T>
+  const T& get()const{return *reinterpret_cast<const T*>(&storage);}
+
+private:
+  template<typename T>
+  static void copy(void* p,const void* q)
+  {
+    ::new (p) T(*static_cast<const T*>(q));
+  }
+
+  template<typename T>
+  static void destroy(void* p)
+  {
+    static_cast<T*>(p)->~T();
+  }
+
+  typename std::aligned_union<0,Ts...>::type storage;
+  std::size_t                                tag_;
+};
+
+/* Size sweep measured column by column rather than row by row, so that
+ * each column can build its data once for the largest size, work on
+ * prefixes and release it before the next column starts: only one
+ * column's data is in memory at any time. Rows are printed at the end;
+ * the setup column adds up, for each size, the time spent outside
+ * measure() right before each of its measurements (building a column's
+ * data thus shows up in the first row).
+ */
+
+class size_sweep
+{
+public:
+  size_sweep(std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+  {
+    for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+      sizes.push_back(n);
+    }
+    rows.resize(sizes.size());
+    setup_times.resize(sizes.size());
+  }
+
+  /* f(n) is measured for every size n, after prepare(n) if given */
+
+  template<typename F>
+  void column(F f)
+  {
+    column([](std::size_t){},f);
+  }
+
+  template<typename Prepare,typename F>
+  void column(Prepare prepare,F f)
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::size_t        n=sizes[i];
+      std::ostringstream os;
+      prepare(n);
+      setup_times[i]+=setup_time();
+      os<<measure(n,[&](){return f(n);})<<";";
+      rows[i]+=os.str();
+    }
+  }
+
+  void not_measured_column()
+  {
+    for(auto& row:rows)row+=std::string(not_measured)+";";
+  }
+
+  void print()
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::cout<<sizes[i]<<";"<<rows[i]<<setup_times[i]<<"\n";
+    }
+  }
+
+private:
+  std::vector<std::size_t> sizes;
+  std::vector<std::string> rows;
+  std::vector<double>      setup_times;
+};
+
+/* Header naming every field printed for each of the given columns
+ * (separated by ';'), e.g. "aos mean;aos p50;..." in latency mode.
+ */
+
+std::string measure_header(const std::string& columns)
+{
+  std::string res;
+  for(std::size_t first=0;;){
+    std::size_t last=columns.find(';',first);
+    std::string column=columns.substr(first,last-first);
+    for(const char* field:measure_fields){
+      if(!res.empty())res+=";";
+      res+=column+field;
+    }
+    if(last==std::string::npos)return res;
+    first=last+1;
+  }
+}
+
+/* Each object carries its own datum and each type does some arithmetic
+ * of its own on it, so that statically bound calls in the switch and
+ * variant columns can't be folded into a function of the type index.
+ */
+
 struct base
 {
+  base():x(next_x++){}
   virtual int f()const=0;
   virtual ~base(){}
+
+  int               x;
+  inline static int next_x=0;
 };
 
 struct derived1:base
 {
-  virtual int f()const{return 1;};  
+  virtual int f()const{return x%3;};  
 };
 
 struct derived2:base
 {
-  virtual int f()const{return 2;};  
+  virtual int f()const{return x%5;};  
 };
 
 struct derived3:base
 {
-  virtual int f()const{return 3;};  
+  virtual int f()const{return x%7;};  
 };
 
 int main()
@@ -196,56 +747,186 @@ int main()
   double      fdn=1.1;    
 
   std::cout<<"polymorphic containers:"<<std::endl;
-  std::cout<<"n;unsorted;sorted;poly_collection"<<std::endl;
-    
-  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
-    std::cout<<n<<";";
-    {
-      using pointer=std::shared_ptr<base>;
-      std::vector<pointer>            v;
-      std::mt19937                    gen;
-      std::uniform_int_distribution<> rnd(1,3);
-      v.reserve(n);
-      for(std::size_t i=0;i<n;++i){
-        switch(rnd(gen)){
-          case 1:  v.push_back(std::make_shared<derived1>());break;
-          case 2:  v.push_back(std::make_shared<derived2>());break;
-          case 3: 
-          default: v.push_back(std::make_shared<derived3>());break;
-        }
+  std::cout<<"n;"<<measure_header(
+    "unsorted;sorted;fragmented;arena;poly_collection;"
+    "variant;switch;function table")<<";setup"<<std::endl;
+
+  /* Types are drawn once for the largest size and kept throughout. The
+   * objects pointed to in the unsorted and sorted columns are also created
+   * once, each step shuffling or sorting a copy of a prefix of the
+   * pointers; variant and tagged object columns work on prefixes, and
+   * poly_collection grows from one step to the next. Fragmented and arena
+   * columns allocate anew at each step, as allocation is what they are
+   * about. Each column's data is released before the next column starts.
+   */
+  using pointer=std::shared_ptr<base>;
+  using variant=std::variant<derived1,derived2,derived3>;
+  using tagged=tagged_object<derived1,derived2,derived3>;
+
+  size_sweep       sweep(n0,n1,dn,fdn);
+  std::vector<int> types;
+  {
+    std::mt19937                    gen;
+    std::uniform_int_distribution<> rnd(1,3);
+    types.reserve(n1);
+    for(std::size_t i=0;i<n1;++i)types.push_back(rnd(gen));
+  }
+
+  auto sum_pointers=[](const std::vector<pointer>& v){
+    long int res=0;
+    for(const auto& p:v)res+=p->f();
+    return res;
+  };
+
+  {
+    std::vector<pointer> pointers;
+    pointers.reserve(n1);
+    for(std::size_t i=0;i<n1;++i){
+      switch(types[i]){
+        case 1:  pointers.push_back(std::make_shared<derived1>());break;
+        case 2:  pointers.push_back(std::make_shared<derived2>());break;
+        case 3: 
+        default: pointers.push_back(std::make_shared<derived3>());break;
       }
-      std::shuffle(v.begin(),v.end(),gen);
+    }
 
-      auto f=[&](){
+    for(bool sorted:{false,true}){
+      std::vector<pointer> v;
+      sweep.column(
+        [&](std::size_t n){
+          v.assign(pointers.begin(),pointers.begin()+n);
+          std::mt19937 gen;
+          std::shuffle(v.begin(),v.end(),gen);
+          if(sorted){
+            std::sort(v.begin(),v.end(),
+              [](const pointer& p,const pointer& q){
+                return std::type_index(typeid(*p))<
+                  std::type_index(typeid(*q));
+              });
+          }
+        },
+        [&](std::size_t){return sum_pointers(v);});
+    }
+  }
+  {
+    std::vector<pointer> v;
+    sweep.column(
+      [&](std::size_t n){
+        std::vector<pointer>().swap(v);
+        auto holes=
+          fragment_heap(n,sizeof(derived1)+2*sizeof(long)); /* ~make_shared */
+        v.reserve(n);
+        for(std::size_t i=0;i<n;++i){
+          switch(types[i]){
+            case 1:  v.push_back(std::make_shared<derived1>());break;
+            case 2:  v.push_back(std::make_shared<derived2>());break;
+            case 3: 
+            default: v.push_back(std::make_shared<derived3>());break;
+          }
+        }
+      },
+      [&](std::size_t){return sum_pointers(v);});
+  }
+  {
+    std::unique_ptr<monotonic_arena> arena;
+    std::vector<pointer>             v;
+    sweep.column(
+      [&](std::size_t n){
+        std::vector<pointer>().swap(v); /* before its arena goes */
+        arena.reset(new monotonic_arena);
+        arena_allocator<base> al(*arena);
+        v.reserve(n);
+        for(std::size_t i=0;i<n;++i){
+          switch(types[i]){
+            case 1:  v.push_back(std::allocate_shared<derived1>(al));break;
+            case 2:  v.push_back(std::allocate_shared<derived2>(al));break;
+            case 3: 
+            default: v.push_back(std::allocate_shared<derived3>(al));break;
+          }
+        }
+      },
+      [&](std::size_t){return sum_pointers(v);});
+    v.clear();
+  }
+  {
+    poly_collection<base> pc;
+    std::size_t           grown=0;
+    sweep.column(
+      [&](std::size_t n){
+        for(;grown<n;++grown){
+          switch(types[grown]){
+            case 1:  pc.insert(derived1());break;
+            case 2:  pc.insert(derived2());break;
+            case 3: 
+            default: pc.insert(derived3());break;
+          }
+        }
+      },
+      [&](std::size_t){
         long int res=0;
-        for(const auto& p:v)res+=p->f();
+        pc.for_each([&](const base& x){res+=x.f();});
         return res;
-      };
-
-      std::cout<<measure(n,f)<<";";
-      std::sort(v.begin(),v.end(),[](const pointer& p,const pointer& q){
-        return std::type_index(typeid(*p))<std::type_index(typeid(*q));
       });
-      std::cout<<measure(n,f)<<";";
+  }
+  {
+    std::vector<variant> variants;
+    variants.reserve(n1);
+    for(std::size_t i=0;i<n1;++i){
+      switch(types[i]){
+        case 1:  variants.push_back(derived1());break;
+        case 2:  variants.push_back(derived2());break;
+        case 3: 
+        default: variants.push_back(derived3());break;
+      }
     }
-    {
-      poly_collection<base>           v;
-      std::mt19937                    gen;
-      std::uniform_int_distribution<> rnd(1,3);
+    sweep.column([&](std::size_t n){
+      long int res=0;
       for(std::size_t i=0;i<n;++i){
-        switch(rnd(gen)){
-          case 1:  v.insert(derived1());break;
-          case 2:  v.insert(derived2());break;
-          case 3: 
-          default: v.insert(derived3());break;
-        }
+        res+=std::visit([](const auto& y){
+          using type=typename std::decay<decltype(y)>::type;
+          return y.type::f();
+        },variants[i]);
       }
+      return res;
+    });
+  }
+  {
+    static int (*const table[])(const tagged&)={
+      [](const tagged& x){return x.get<derived1>().derived1::f();},
+      [](const tagged& x){return x.get<derived2>().derived2::f();},
+      [](const tagged& x){return x.get<derived3>().derived3::f();}
+    };
 
-      std::cout<<measure(n,[&](){
-        long int res=0;
-        v.for_each([&](const base& x){res+=x.f();});
-        return res;
-      })<<"\n";
+    std::vector<tagged> tagged_objects;
+    tagged_objects.reserve(n1);
+    for(std::size_t i=0;i<n1;++i){
+      switch(types[i]){
+        case 1:  tagged_objects.push_back(tagged(derived1()));break;
+        case 2:  tagged_objects.push_back(tagged(derived2()));break;
+        case 3: 
+        default: tagged_objects.push_back(tagged(derived3()));break;
+      }
     }
+    sweep.column([&](std::size_t n){
+      long int res=0;
+      for(std::size_t i=0;i<n;++i){
+        const auto& x=tagged_objects[i];
+        switch(x.tag()){
+          case 0:  res+=x.get<derived1>().derived1::f();break;
+          case 1:  res+=x.get<derived2>().derived2::f();break;
+          case 2:
+          default: res+=x.get<derived3>().derived3::f();break;
+        }
+      }
+      return res;
+    });
+    sweep.column([&](std::size_t n){
+      long int res=0;
+      for(std::size_t i=0;i<n;++i){
+        res+=table[tagged_objects[i].tag()](tagged_objects[i]);
+      }
+      return res;
+    });
   }
+  sweep.print();
 }
@@ -0,0 +1,374 @@
+/* usingstdcpp2015: dispatch strategies for closed class hierarchies.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+ 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric> 
+    
+std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+        
+template<typename F>
+double measure(F f)
+{
+  using namespace std::chrono;
+        
+  static const int              num_trials=10;
+  static const milliseconds     min_time_per_trial(200);
+  std::array<double,num_trials> trials;
+  volatile decltype(f())        res; /* to avoid optimizing f() away */
+        
+  for(int i=0;i<num_trials;++i){
+    int                               runs=0;
+    high_resolution_clock::time_point t2;
+        
+    measure_start=high_resolution_clock::now();
+    do{
+      res=f();
+      ++runs;
+      t2=high_resolution_clock::now();
+    }while(t2-measure_start<min_time_per_trial);
+    trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
+  }
+  (void)(res); /* var not used warn */
+        
+  std::sort(trials.begin(),trials.end());
+  return std::accumulate(
+    trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+}
+ 
+template<typename Size,typename F>
+double measure(Size n,F f)
+{
+  return measure(f)/n;
+}
+
+void pause_timing()
+{
+  measure_pause=std::chrono::high_resolution_clock::now();
+}
+        
+void resume_timing()
+{
+  measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
+}
+
+#include <algorithm>
+#include <boost/preprocessor/repetition/repeat.hpp>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/* Type-tagged union over a closed set of types Ts...: objects are stored
+ * in place along with the index of their type, so that operations can be
+ * dispatched with a switch on the tag or through a table of function
+ * pointers indexed by it, both resolving to statically bound calls.
+ */
+
+template<typename T,typename... Ts>
+struct type_index_of;
+
+template<typename T,typename... Ts>
+struct type_index_of<T,T,Ts...>:std::integral_constant<std::size_t,0>{};
+
+template<typename T,typename U,typename... Ts>
+struct type_index_of<T,U,Ts...>:
+  std::integral_constant<std::size_t,1+type_index_of<T,Ts...>::value>{};
+
+template<typename... Ts>
+class tagged_object
+{
+public:
+  template<typename T>
+  explicit tagged_object(const T& x):tag_(type_index_of<T,Ts...>::value)
+  {
+    ::new (static_cast<void*>(&storage)) T(x);
+  }
+
+  tagged_object(const tagged_object& x):tag_(x.tag_)
+  {
+    static void (*const copy_table[])(void*,const void*)={&copy<Ts>...};
+    copy_table[tag_](&storage,&x.storage);
+  }
+
+  tagged_object& operator=(const tagged_object& x)
+  {
+    if(this!=&x){
+      this->~tagged_object();
+      ::new (static_cast<void*>(this)) tagged_object(x);
+    }
+    return *this;
+  }
+
+  ~tagged_object()
+  {
+    static void (*const destroy_table[])(void*)={&destroy<Ts>...};
+    destroy_table[tag_](&storage);
+  }
+
+  std::size_t tag()const{return tag_;}
+
+  template<typename T>
+  const T& get()const{return *reinterpret_cast<const T*>(&storage);}
+
+private:
+  template<typename T>
+  static void copy(void* p,const void* q)
+  {
+    ::new (p) T(*static_cast<const T*>(q));
+  }
+
+  template<typename T>
+  static void destroy(void* p)
+  {
+    static_cast<T*>(p)->~T();
+  }
+
+  typename std::aligned_union<0,Ts...>::type storage;
+  std::size_t                                tag_;
+};
+
+/* Each object carries its own datum and each type does some arithmetic
+ * of its own on it, so that calls can't be folded into a function of the
+ * tag and the different dispatch strategies actually branch.
+ */
+
+struct base
+{
+  base():x(next_x++){}
+  virtual int f()const=0;
+  virtual ~base(){}
+
+  int               x;
+  inline static int next_x=0;
+};
+
+template<std::size_t N>
+struct derived:base
+{
+  virtual int f()const{return x%int(N+2);};  
+};
+
+/* The closed hierarchy {derived<0>,...,derived<K-1>} viewed through each
+ * of the dispatch strategies compared. tagged_object always spans the
+ * maximum number of types so that the switch below can be written once;
+ * only tags less than K actually occur.
+ */
+
+#define MAX_TYPES 64 /* a literal, as BOOST_PP_REPEAT needs */
+
+static const std::size_t max_types=MAX_TYPES;
+
+template<typename Sequence>
+struct closed_hierarchy_impl;
+
+template<std::size_t... I>
+struct closed_hierarchy_impl<std::index_sequence<I...>>
+{
+  using variant=std::variant<derived<I>...>;
+};
+
+template<typename Sequence>
+struct tagged_impl;
+
+template<std::size_t... I>
+struct tagged_impl<std::index_sequence<I...>>
+{
+  using type=tagged_object<derived<I>...>;
+
+  static type make(std::size_t i)
+  {
+    static type (*const table[])()={&make_<I>...};
+    return table[i]();
+  }
+
+  static int call_through_table(const type& x)
+  {
+    static int (*const table[])(const type&)={&call_<I>...};
+    return table[x.tag()](x);
+  }
+
+private:
+  template<std::size_t N>
+  static type make_(){return type(derived<N>());}
+
+  template<std::size_t N>
+  static int call_(const type& x)
+  {
+    return x.template get<derived<N>>().derived<N>::f();
+  }
+};
+
+using tagged=tagged_impl<std::make_index_sequence<max_types>>;
+
+#define DISPATCH_CASE(z,n,x)                                 \
+  case n: return x.template get<derived<n>>().derived<n>::f();
+
+int call_through_switch(const tagged::type& x)
+{
+  switch(x.tag()){
+    BOOST_PP_REPEAT(MAX_TYPES,DISPATCH_CASE,x)
+    default: return 0;
+  }
+}
+
+#undef DISPATCH_CASE
+
+template<std::size_t K>
+struct closed_hierarchy
+{
+  using variant=typename closed_hierarchy_impl<
+    std::make_index_sequence<K>>::variant;
+
+  static std::unique_ptr<base> make_pointer(std::size_t i)
+  {
+    return make_pointer(i,std::make_index_sequence<K>());
+  }
+
+  static variant make_variant(std::size_t i)
+  {
+    return make_variant(i,std::make_index_sequence<K>());
+  }
+
+private:
+  template<std::size_t N>
+  static std::unique_ptr<base> make_pointer_()
+  {
+    return std::unique_ptr<base>(new derived<N>());
+  }
+
+  template<std::size_t... I>
+  static std::unique_ptr<base> make_pointer(
+    std::size_t i,std::index_sequence<I...>)
+  {
+    static std::unique_ptr<base> (*const table[])()={&make_pointer_<I>...};
+    return table[i]();
+  }
+
+  template<std::size_t N>
+  static variant make_variant_(){return derived<N>();}
+
+  template<std::size_t... I>
+  static variant make_variant(std::size_t i,std::index_sequence<I...>)
+  {
+    static variant (*const table[])()={&make_variant_<I>...};
+    return table[i]();
+  }
+};
+
+/* Type mixes: uniform, Zipf-like (weight of i-th type ~ 1/(i+1)) and one
+ * dominant type covering 90% of the objects.
+ */
+
+enum class type_mix{uniform,zipf,dominant};
+
+std::discrete_distribution<std::size_t> make_type_distribution(
+  std::size_t k,type_mix mix)
+{
+  std::vector<double> weights(k);
+  for(std::size_t i=0;i<k;++i){
+    switch(mix){
+      case type_mix::uniform: weights[i]=1.0;break;
+      case type_mix::zipf:    weights[i]=1.0/(i+1);break;
+      case type_mix::dominant:
+      default:                weights[i]=i==0?0.9*(k-1)/0.1:1.0;break;
+    }
+  }
+  return std::discrete_distribution<std::size_t>(
+    weights.begin(),weights.end());
+}
+
+const char* type_mix_name(type_mix mix)
+{
+  switch(mix){
+    case type_mix::uniform: return "uniform";
+    case type_mix::zipf:    return "zipf";
+    case type_mix::dominant:
+    default:                return "dominant";
+  }
+}
+
+template<std::size_t K>
+void measure_dispatch(std::size_t n,type_mix mix)
+{
+  using hierarchy=closed_hierarchy<K>;
+
+  std::cout<<K<<";"<<type_mix_name(mix)<<";";
+
+  std::vector<std::size_t> types;
+  {
+    std::mt19937 gen;
+    auto         rnd=make_type_distribution(K,mix);
+    types.reserve(n);
+    for(std::size_t i=0;i<n;++i)types.push_back(rnd(gen));
+  }
+  {
+    std::vector<std::unique_ptr<base>> v;
+    v.reserve(n);
+    for(auto i:types)v.push_back(hierarchy::make_pointer(i));
+    std::cout<<measure(n,[&](){
+      long int res=0;
+      for(const auto& p:v)res+=p->f();
+      return res;
+    })<<";";
+  }
+  {
+    std::vector<typename hierarchy::variant> v;
+    v.reserve(n);
+    for(auto i:types)v.push_back(hierarchy::make_variant(i));
+    std::cout<<measure(n,[&](){
+      long int res=0;
+      for(const auto& x:v){
+        res+=std::visit([](const auto& y){
+          using type=typename std::decay<decltype(y)>::type;
+          return y.type::f();
+        },x);
+      }
+      return res;
+    })<<";";
+  }
+  {
+    std::vector<tagged::type> v;
+    v.reserve(n);
+    for(auto i:types)v.push_back(tagged::make(i));
+    std::cout<<measure(n,[&](){
+      long int res=0;
+      for(const auto& x:v)res+=call_through_switch(x);
+      return res;
+    })<<";";
+    std::cout<<measure(n,[&](){
+      long int res=0;
+      for(const auto& x:v)res+=tagged::call_through_table(x);
+      return res;
+    })<<"\n";
+  }
+}
+
+template<std::size_t... K>
+void measure_dispatch_sweep(std::size_t n,type_mix mix)
+{
+  (measure_dispatch<K>(n,mix),...);
+}
+
+int main()
+{
+  std::size_t n=1000000;
+
+  std::cout<<"dispatch strategies ("<<n<<" elements):"<<std::endl;
+  std::cout<<"types;mix;virtual;variant;switch;function table"<<std::endl;
+
+  for(auto mix:{type_mix::uniform,type_mix::zipf,type_mix::dominant}){
+    measure_dispatch_sweep<3,4,6,8,12,16,24,32,48,64>(n,mix);
+  }
+}
@@ -12,9 +12,127 @@
 #include <numeric> 
     
 std::chrono::high_resolution_clock::time_point measure_start,measure_pause;
+std::chrono::high_resolution_clock::time_point setup_start=
+  std::chrono::high_resolution_clock::now();
+std::chrono::high_resolution_clock::duration   measure_elapsed(0);
+
+/* Compiling with MEASURE_LATENCY defined makes measure() also time each
+ * invocation of f individually (with rdtsc where available) into a
+ * log-bucketed histogram, and return its p50, p99, p99.9 and max next to
+ * the usual trimmed mean; each column then prints as mean;p50;p99;p99.9;max.
+ */
+
+#if defined(MEASURE_LATENCY)
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#if defined(__x86_64__)||defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+inline std::uint64_t cycle_count()
+{
+#if defined(__x86_64__)||defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+double cycles_per_second()
+{
+  using namespace std::chrono;
+
+  static const double res=[]{
+    steady_clock::time_point t0=steady_clock::now();
+    std::uint64_t            c0=cycle_count();
+    while(steady_clock::now()-t0<milliseconds(100));
+    std::uint64_t            c1=cycle_count();
+    return (c1-c0)/duration_cast<duration<double>>(
+      steady_clock::now()-t0).count();
+  }();
+  return res;
+}
+
+/* HDR-style histogram: values below 2^sub_bucket_bits are recorded
+ * exactly, larger ones with a relative precision of 2^-sub_bucket_bits.
+ */
+
+class latency_histogram
+{
+public:
+  latency_histogram():counts((64-sub_bucket_bits+1)<<sub_bucket_bits){}
+
+  void add(std::uint64_t x)
+  {
+    ++counts[bucket(x)];
+    ++total;
+    if(x>max_)max_=x;
+  }
+
+  std::uint64_t percentile(double q)const
+  {
+    std::uint64_t threshold=static_cast<std::uint64_t>(q*total),acc=0;
+    for(std::size_t i=0;i<counts.size();++i){
+      acc+=counts[i];
+      if(acc>threshold)return std::min(value(i),max_);
+    }
+    return max_;
+  }
+
+  std::uint64_t max()const{return max_;}
+
+private:
+  static const int sub_bucket_bits=7;
+
+  static std::size_t bucket(std::uint64_t x)
+  {
+    if(x<(std::uint64_t(1)<<sub_bucket_bits))return x;
+    int shift=63-__builtin_clzll(x)-sub_bucket_bits;
+    return (std::size_t(shift+1)<<sub_bucket_bits)+
+      ((x>>shift)-(std::uint64_t(1)<<sub_bucket_bits));
+  }
+
+  static std::uint64_t value(std::size_t i)
+  {
+    if(i<(std::size_t(1)<<sub_bucket_bits))return i;
+    int shift=static_cast<int>(i>>sub_bucket_bits)-1;
+    std::uint64_t mantissa=
+      (i&((std::size_t(1)<<sub_bucket_bits)-1))+
+      (std::uint64_t(1)<<sub_bucket_bits);
+    return ((mantissa+1)<<shift)-1; /* upper bound of the bucket */
+  }
+
+  std::vector<std::uint64_t> counts;
+  std::uint64_t              total=0,max_=0;
+};
+
+struct measure_result
+{
+  double mean,p50,p99,p999,max;
+};
+
+measure_result operator/(const measure_result& x,double n)
+{
+  return {x.mean/n,x.p50/n,x.p99/n,x.p999/n,x.max/n};
+}
+
+std::ostream& operator<<(std::ostream& os,const measure_result& x)
+{
+  return os<<x.mean<<";"<<x.p50<<";"<<x.p99<<";"<<x.p999<<";"<<x.max;
+}
+
+const char* not_measured="n/a;n/a;n/a;n/a;n/a";
+const char* const measure_fields[]={" mean"," p50"," p99"," p99.9"," max"};
+#else
+typedef double measure_result;
+
+const char* not_measured="n/a";
+const char* const measure_fields[]={""};
+#endif
         
 template<typename F>
-double measure(F f)
+measure_result measure(F f)
 {
   using namespace std::chrono;
         
@@ -22,6 +140,10 @@ double measure(F f)
   static const milliseconds     min_time_per_trial(200);
   std::array<double,num_trials> trials;
   volatile decltype(f())        res; /* to avoid optimizing f() away */
+  high_resolution_clock::time_point t0=high_resolution_clock::now();
+#if defined(MEASURE_LATENCY)
+  latency_histogram             histogram;
+#endif
         
   for(int i=0;i<num_trials;++i){
     int                               runs=0;
@@ -29,21 +151,40 @@ double measure(F f)
         
     measure_start=high_resolution_clock::now();
     do{
+#if defined(MEASURE_LATENCY)
+      std::uint64_t c0=cycle_count();
+      res=f();
+      histogram.add(cycle_count()-c0);
+#else
       res=f();
+#endif
       ++runs;
       t2=high_resolution_clock::now();
     }while(t2-measure_start<min_time_per_trial);
     trials[i]=duration_cast<duration<double>>(t2-measure_start).count()/runs;
   }
   (void)(res); /* var not used warn */
+  measure_elapsed+=high_resolution_clock::now()-t0;
         
   std::sort(trials.begin(),trials.end());
-  return std::accumulate(
+  double mean=std::accumulate(
     trials.begin()+2,trials.end()-2,0.0)/(trials.size()-4)*1E6;
+#if defined(MEASURE_LATENCY)
+  double us_per_cycle=1E6/cycles_per_second();
+  return {
+    mean,
+    histogram.percentile(0.5)*us_per_cycle,
+    histogram.percentile(0.99)*us_per_cycle,
+    histogram.percentile(0.999)*us_per_cycle,
+    histogram.max()*us_per_cycle
+  };
+#else
+  return mean;
+#endif
 }
  
 template<typename Size,typename F>
-double measure(Size n,F f)
+measure_result measure(Size n,F f)
 {
   return measure(f)/n;
 }
@@ -58,9 +199,119 @@ void resume_timing()
   measure_start+=std::chrono::high_resolution_clock::now()-measure_pause;
 }
 
+/* Seconds elapsed since the previous call (or program start) not spent
+ * inside measure(), i.e. setting up data.
+ */
+
+double setup_time()
+{
+  using namespace std::chrono;
+
+  high_resolution_clock::time_point now=high_resolution_clock::now();
+  double res=duration_cast<duration<double>>(
+    (now-setup_start)-measure_elapsed).count();
+  setup_start=now;
+  measure_elapsed=high_resolution_clock::duration(0);
+  return res;
+}
+
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <new>
 #include <random>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+
+/* Allocator obtaining memory directly from mmap with a given page policy
+ * (Linux only):
+ *   - small_pages: 4KB pages, transparent huge pages explicitly disabled,
+ *   - transparent_huge_pages: 2MB-aligned region with madvise(MADV_HUGEPAGE),
+ *   - huge_pages_2mb, huge_pages_1gb: hugetlbfs pages, which must have
+ *     been reserved beforehand (e.g. through /proc/sys/vm/nr_hugepages);
+ *     std::bad_alloc is thrown otherwise.
+ */
+
+enum class page_policy
+{
+  small_pages,transparent_huge_pages,huge_pages_2mb,huge_pages_1gb
+};
+
+template<typename T,page_policy Policy>
+class page_allocator
+{
+public:
+  using value_type=T;
+
+  template<typename U>
+  struct rebind{using other=page_allocator<U,Policy>;};
+
+  page_allocator()=default;
+  template<typename U>
+  page_allocator(const page_allocator<U,Policy>&){}
+
+  T* allocate(std::size_t n)
+  {
+    std::size_t size=mapping_size(n);
+    int         flags=MAP_PRIVATE|MAP_ANONYMOUS;
+    if(Policy==page_policy::huge_pages_2mb)
+      flags|=MAP_HUGETLB|(21<<MAP_HUGE_SHIFT);
+    else if(Policy==page_policy::huge_pages_1gb)
+      flags|=MAP_HUGETLB|(30<<MAP_HUGE_SHIFT);
+    else if(Policy==page_policy::transparent_huge_pages)
+      size+=page_size(); /* room for aligning to a huge page boundary */
+
+    void* p=mmap(nullptr,size,PROT_READ|PROT_WRITE,flags,-1,0);
+    if(p==MAP_FAILED)throw std::bad_alloc();
+
+    if(Policy==page_policy::small_pages){
+      madvise(p,size,MADV_NOHUGEPAGE);
+    }
+    else if(Policy==page_policy::transparent_huge_pages){
+      char*       first=static_cast<char*>(p);
+      std::size_t head=(page_size()-
+        reinterpret_cast<std::uintptr_t>(first)%page_size())%page_size();
+      if(head)munmap(first,head);
+      munmap(first+head+mapping_size(n),page_size()-head);
+      p=first+head;
+      madvise(p,mapping_size(n),MADV_HUGEPAGE);
+    }
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p,std::size_t n)
+  {
+    munmap(p,mapping_size(n));
+  }
+
+  template<typename U>
+  friend bool operator==(const page_allocator&,const page_allocator<U,Policy>&)
+    {return true;}
+  template<typename U>
+  friend bool operator!=(const page_allocator&,const page_allocator<U,Policy>&)
+    {return false;}
+
+private:
+  static std::size_t page_size()
+  {
+    switch(Policy){
+      case page_policy::small_pages:            return 4096;
+      case page_policy::transparent_huge_pages:
+      case page_policy::huge_pages_2mb:         return std::size_t(1)<<21;
+      case page_policy::huge_pages_1gb:
+      default:                                  return std::size_t(1)<<30;
+    }
+  }
+
+  static std::size_t mapping_size(std::size_t n)
+  {
+    std::size_t size=n*sizeof(T);
+    return (size+page_size()-1)/page_size()*page_size();
+  }
+};
 
 struct particle
 {
@@ -69,22 +320,36 @@ struct particle
 
 using particle_aos=std::vector<particle>;
 
-particle_aos create_particle_aos(int n)
+template<typename Allocator>
+std::vector<particle,Allocator> create_particle_aos(
+  int n,const Allocator& al)
 {
-  particle_aos res;
+  std::vector<particle,Allocator> res(al);
   res.reserve(n);
   for(int i=0;i<n;++i)res.push_back({i,i+1,i+2});
   return res;
 }
 
-struct particle_soa
+particle_aos create_particle_aos(int n)
 {
-  std::vector<int> x,y,z;
+  return create_particle_aos(n,std::allocator<particle>());
+}
+
+template<typename Allocator>
+struct basic_particle_soa
+{
+  explicit basic_particle_soa(const Allocator& al=Allocator()):
+    x(al),y(al),z(al){}
+
+  std::vector<int,Allocator> x,y,z;
 };
 
-particle_soa create_particle_soa(int n)
+using particle_soa=basic_particle_soa<std::allocator<int>>;
+
+template<typename Allocator>
+basic_particle_soa<Allocator> create_particle_soa(int n,const Allocator& al)
 {
-  particle_soa res;
+  basic_particle_soa<Allocator> res(al);
   res.x.reserve(n);
   res.y.reserve(n);
   res.z.reserve(n);
@@ -96,41 +361,165 @@ particle_soa create_particle_soa(int n)
   return res;
 }
 
+particle_soa create_particle_soa(int n)
+{
+  return create_particle_soa(n,std::allocator<int>());
+}
+
+template<typename ParticleAOS>
+long int random_sum_aos(const ParticleAOS& ps,std::size_t n)
+{
+  std::mt19937                    gen;
+  std::uniform_int_distribution<> rnd(0,n-1);
+  long int                        res=0;
+  for(std::size_t i=0;i<n;++i){
+    auto idx=rnd(gen);
+    res+=ps[idx].x+ps[idx].y+ps[idx].z;
+  }
+  return res;
+}
+
+template<typename ParticleSOA>
+long int random_sum_soa(const ParticleSOA& ps,std::size_t n)
+{
+  std::mt19937                    gen;
+  std::uniform_int_distribution<> rnd(0,n-1);
+  long int                        res=0;
+  for(std::size_t i=0;i<n;++i){
+    auto idx=rnd(gen);
+    res+=ps.x[idx]+ps.y[idx]+ps.z[idx];
+  }
+  return res;
+}
+
+/* Size sweep measured column by column rather than row by row, so that
+ * each column can build its data once for the largest size, work on
+ * prefixes and release it before the next column starts: only one
+ * column's data is in memory at any time. Rows are printed at the end;
+ * the setup column adds up, for each size, the time spent outside
+ * measure() right before each of its measurements (building a column's
+ * data thus shows up in the first row).
+ */
+
+class size_sweep
+{
+public:
+  size_sweep(std::size_t n0,std::size_t n1,std::size_t dn,double fdn)
+  {
+    for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
+      sizes.push_back(n);
+    }
+    rows.resize(sizes.size());
+    setup_times.resize(sizes.size());
+  }
+
+  /* f(n) is measured for every size n, after prepare(n) if given */
+
+  template<typename F>
+  void column(F f)
+  {
+    column([](std::size_t){},f);
+  }
+
+  template<typename Prepare,typename F>
+  void column(Prepare prepare,F f)
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::size_t        n=sizes[i];
+      std::ostringstream os;
+      prepare(n);
+      setup_times[i]+=setup_time();
+      os<<measure(n,[&](){return f(n);})<<";";
+      rows[i]+=os.str();
+    }
+  }
+
+  void not_measured_column()
+  {
+    for(auto& row:rows)row+=std::string(not_measured)+";";
+  }
+
+  void print()
+  {
+    for(std::size_t i=0;i<sizes.size();++i){
+      std::cout<<sizes[i]<<";"<<rows[i]<<setup_times[i]<<"\n";
+    }
+  }
+
+private:
+  std::vector<std::size_t> sizes;
+  std::vector<std::string> rows;
+  std::vector<double>      setup_times;
+};
+
+/* Header naming every field printed for each of the given columns
+ * (separated by ';'), e.g. "aos mean;aos p50;..." in latency mode.
+ */
+
+std::string measure_header(const std::string& columns)
+{
+  std::string res;
+  for(std::size_t first=0;;){
+    std::size_t last=columns.find(';',first);
+    std::string column=columns.substr(first,last-first);
+    for(const char* field:measure_fields){
+      if(!res.empty())res+=";";
+      res+=column+field;
+    }
+    if(last==std::string::npos)return res;
+    first=last+1;
+  }
+}
+
+/* aos and soa columns with memory allocated under the given page policy
+ * for the largest size, not_measured if the system can't provide such
+ * pages.
+ */
+
+template<page_policy Policy>
+void measure_with_pages(size_sweep& sweep,std::size_t n1)
+{
+  try{
+    auto ps=create_particle_aos(n1,page_allocator<particle,Policy>());
+    sweep.column([&](std::size_t n){return random_sum_aos(ps,n);});
+  }
+  catch(const std::bad_alloc&){
+    sweep.not_measured_column();
+  }
+  try{
+    auto ps=create_particle_soa(n1,page_allocator<int,Policy>());
+    sweep.column([&](std::size_t n){return random_sum_soa(ps,n);});
+  }
+  catch(const std::bad_alloc&){
+    sweep.not_measured_column();
+  }
+}
+
 int main()
 {
   std::size_t n0=10000,n1=40000000,dn=2000;
   double      fdn=1.1;    
 
   std::cout<<"random access aos vs soa:"<<std::endl;
-  std::cout<<"n;aos;soa"<<std::endl;
-    
-  for(std::size_t n=n0;n<=n1;n+=dn,dn=(unsigned int)(dn*fdn)){
-    std::cout<<n<<";";
-    {
-      auto ps=create_particle_aos(n);
-      std::cout<<measure(n,[&](){
-        std::mt19937                    gen;
-        std::uniform_int_distribution<> rnd(0,n-1);
-        long int                        res=0;
-        for(std::size_t i=0;i<n;++i){
-          auto idx=rnd(gen);
-          res+=ps[idx].x+ps[idx].y+ps[idx].z;
-        }
-        return res;
-      })<<";";
-    }
-    {
-      auto ps=create_particle_soa(n);
-      std::cout<<measure(n,[&](){
-        std::mt19937                    gen;
-        std::uniform_int_distribution<> rnd(0,n-1);
-        long int                        res=0;
-        for(std::size_t i=0;i<n;++i){
-          auto idx=rnd(gen);
-          res+=ps.x[idx]+ps.y[idx]+ps.z[idx];
-        }
-        return res;
-      })<<"\n";
-    }
+  std::cout<<"n;"<<measure_header(
+    "aos;soa;aos 4K;soa 4K;aos THP;soa THP;aos 2M;soa 2M;aos 1G;soa 1G")
+           <<";setup"<<std::endl;
+
+  /* every column works on prefixes of data generated once for the
+   * largest size
+   */
+  size_sweep sweep(n0,n1,dn,fdn);
+  {
+    auto aos=create_particle_aos(n1);
+    sweep.column([&](std::size_t n){return random_sum_aos(aos,n);});
+  }
+  {
+    auto soa=create_particle_soa(n1);
+    sweep.column([&](std::size_t n){return random_sum_soa(soa,n);});
   }
+  measure_with_pages<page_policy::small_pages>(sweep,n1);
+  measure_with_pages<page_policy::transparent_huge_pages>(sweep,n1);
+  measure_with_pages<page_policy::huge_pages_2mb>(sweep,n1);
+  measure_with_pages<page_policy::huge_pages_1gb>(sweep,n1);
+  sweep.print();
 }
@@ -0,0 +1,280 @@
+/* usingstdcpp2015: out-of-core streaming scans with overlapped I/O.
+ *
+ * Copyright 2015 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+/* Scans an int dataset (as written by dataset_generator, and typically
+ * larger than RAM) chunk by chunk, running the filtered sum and linear
+ * traversal kernels on each chunk. For a range of chunk sizes, one pass
+ * over the file is timed in each of these modes:
+ *
+ *   - read only: reading chunks, no computation,
+ *   - compute only: computation over an in-memory chunk, no I/O,
+ *   - sync: read a chunk, then process it,
+ *   - overlapped: a background thread reads the next chunk into a second
+ *     buffer while the current one is processed.
+ *
+ * Compute fully overlaps with I/O when overlapped approaches the larger of
+ * read only and compute only rather than their sum. The file's pages are
+ * dropped from the page cache before each pass so that reads hit the
+ * device, and kernel readahead is disabled (POSIX_FADV_RANDOM) so that
+ * sync reads don't get overlapped behind our back. Buffers are allocated
+ * and touched before the passes are timed. Figures are microseconds per
+ * element, as elsewhere.
+ */
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* Reads up to size bytes at offset, retrying on short reads; returns the
+ * number of bytes read, less than size only at end of file.
+ */
+
+std::size_t pread_full(int fd,char* buf,std::size_t size,off_t offset)
+{
+  std::size_t res=0;
+  while(res<size){
+    ssize_t r=pread(fd,buf+res,size-res,offset+res);
+    if(r<0)throw std::runtime_error("read error");
+    if(r==0)break;
+    res+=static_cast<std::size_t>(r);
+  }
+  return res;
+}
+
+/* Double-buffered chunk reader: a background thread reads consecutive
+ * chunks of the file into two alternating buffers of chunk_size bytes
+ * provided by the user, staying one chunk ahead of the consumer. Reading
+ * starts with the first call to next().
+ */
+
+class chunk_reader
+{
+public:
+  chunk_reader(int fd,std::size_t chunk_size,char* buf0,char* buf1):
+    fd(fd),chunk_size(chunk_size)
+  {
+    buffers[0].data=buf0;
+    buffers[1].data=buf1;
+    reader=std::thread([this](){run();});
+  }
+
+  chunk_reader(const chunk_reader&)=delete;
+  chunk_reader& operator=(const chunk_reader&)=delete;
+
+  ~chunk_reader()
+  {
+    {
+      std::lock_guard<std::mutex> lk(m);
+      stop=true;
+    }
+    cv.notify_all();
+    reader.join();
+  }
+
+  /* Next chunk of the file, empty at end of file. The chunk previously
+   * returned is handed back to the reader thread.
+   */
+
+  std::pair<const char*,std::size_t> next()
+  {
+    std::unique_lock<std::mutex> lk(m);
+    if(!started){
+      started=true;
+      cv.notify_all();
+    }
+    if(holding){
+      buffers[current].full=false;
+      current^=1;
+      cv.notify_all();
+    }
+    cv.wait(lk,[this](){return buffers[current].full;});
+    holding=true;
+    if(failed)throw std::runtime_error("read error");
+    return {buffers[current].data,buffers[current].size};
+  }
+
+private:
+  struct buffer
+  {
+    char*       data=nullptr;
+    std::size_t size=0;
+    bool        full=false;
+  };
+
+  void run()
+  {
+    {
+      std::unique_lock<std::mutex> lk(m);
+      cv.wait(lk,[&](){return started||stop;});
+    }
+
+    off_t offset=0;
+    for(int i=0;;i^=1){
+      {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk,[&](){return !buffers[i].full||stop;});
+        if(stop)return;
+      }
+
+      std::size_t size=0;
+      bool        error=false;
+      try{
+        size=pread_full(fd,buffers[i].data,chunk_size,offset);
+      }
+      catch(const std::runtime_error&){
+        error=true;
+      }
+      offset+=size;
+
+      {
+        std::lock_guard<std::mutex> lk(m);
+        buffers[i].size=size;
+        buffers[i].full=true;
+        failed=error;
+      }
+      cv.notify_all();
+      if(size==0)return;
+    }
+  }
+
+  int                     fd;
+  std::size_t             chunk_size;
+  std::array<buffer,2>    buffers;
+  std::mutex              m;
+  std::condition_variable cv;
+  std::thread             reader;
+  int                     current=0;
+  bool                    started=false,holding=false,stop=false,
+                          failed=false;
+};
+
+/* filtered sum plus linear traversal of a chunk */
+
+long int process_chunk(const char* data,std::size_t size)
+{
+  const int* first=reinterpret_cast<const int*>(data);
+  const int* last=first+size/sizeof(int);
+  long int   res=0;
+  for(const int* p=first;p!=last;++p)if(*p>128)res+=*p;
+  return res+std::accumulate(first,last,0L);
+}
+
+void drop_cache(int fd)
+{
+  posix_fadvise(fd,0,0,POSIX_FADV_DONTNEED);
+}
+
+template<typename F>
+double time_pass(std::size_t n,F f)
+{
+  using namespace std::chrono;
+
+  volatile long int        res; /* to avoid optimizing f() away */
+  steady_clock::time_point t0=steady_clock::now();
+  res=f();
+  (void)(res); /* var not used warn */
+  return duration_cast<duration<double>>(steady_clock::now()-t0).count()/
+    n*1E6;
+}
+
+int main(int argc,char* argv[])
+{
+  if(argc!=2){
+    std::cerr<<"usage: "<<argv[0]<<" int_dataset"<<std::endl;
+    return 1;
+  }
+
+  int fd=open(argv[1],O_RDONLY);
+  if(fd==-1){
+    std::cerr<<"can't open "<<argv[1]<<std::endl;
+    return 1;
+  }
+  posix_fadvise(fd,0,0,POSIX_FADV_RANDOM);
+  struct stat st;
+  fstat(fd,&st);
+  std::size_t file_size=static_cast<std::size_t>(st.st_size),
+              n=file_size/sizeof(int);
+  if(!n){
+    std::cerr<<argv[1]<<" is empty"<<std::endl;
+    return 1;
+  }
+
+  std::cout<<"streaming scan ("<<n<<" elements):"<<std::endl;
+  std::cout<<"chunk size;read only;compute only;sync;overlapped"<<std::endl;
+
+  try{
+    for(std::size_t chunk_size=std::size_t(1)<<16;chunk_size<=(1<<26);
+        chunk_size*=4){
+      std::vector<char> buf(chunk_size),buf2(chunk_size); /* touched */
+
+      std::cout<<chunk_size<<";";
+      drop_cache(fd);
+      std::cout<<time_pass(n,[&](){
+        long int res=0;
+        for(off_t offset=0;;){
+          std::size_t size=pread_full(fd,buf.data(),chunk_size,offset);
+          if(!size)break;
+          res+=static_cast<unsigned char>(buf[0]);
+          offset+=size;
+        }
+        return res;
+      })<<";";
+
+      std::size_t first_size=pread_full(fd,buf.data(),chunk_size,0);
+      std::cout<<time_pass(n,[&](){
+        long int res=0;
+        for(std::size_t done=0;done<file_size;done+=first_size){
+          res+=process_chunk(buf.data(),first_size);
+        }
+        return res;
+      })<<";";
+
+      drop_cache(fd);
+      std::cout<<time_pass(n,[&](){
+        long int res=0;
+        for(off_t offset=0;;){
+          std::size_t size=pread_full(fd,buf.data(),chunk_size,offset);
+          if(!size)break;
+          res+=process_chunk(buf.data(),size);
+          offset+=size;
+        }
+        return res;
+      })<<";";
+
+      drop_cache(fd);
+      chunk_reader reader(fd,chunk_size,buf.data(),buf2.data());
+      std::cout<<time_pass(n,[&](){
+        long int res=0;
+        for(;;){
+          auto chunk=reader.next();
+          if(!chunk.second)break;
+          res+=process_chunk(chunk.first,chunk.second);
+        }
+        return res;
+      })<<"\n";
+    }
+  }
+  catch(const std::exception& e){
+    std::cerr<<e.what()<<std::endl;
+    close(fd);
+    return 1;
+  }
+  close(fd);
+}